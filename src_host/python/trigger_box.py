@@ -0,0 +1,263 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+"""Python binding of the host library of the Arduino trigger box, by ctypes, so
+that it needs nothing but the shared library built from `src_host`.
+
+The parsing and the time reconstruction run in the library. The records come
+out in batches as a ctypes array of `Record`, which exposes the buffer
+protocol, so that e.g. `numpy.frombuffer(records, dtype=RECORD_DTYPE)` views
+them without copying.
+
+Example, with pyserial::
+
+    import serial
+    from trigger_box import TriggerBox
+
+    box = TriggerBox(serial.Serial("/dev/ttyACM0", timeout=0.1))
+    box.send("b")  # Switch the pulse reports to binary records
+    box.send("s")
+    while True:
+        for rec in box.poll():
+            if rec.type == ord("P"):
+                print(rec.pulse_idx, rec.t_host)
+
+The library gets looked up in the environment variable `TRIGGER_BOX_LIB`,
+next to this file and in the `build` directory of `src_host`.
+"""
+__author__ = "Dennis van Gils"
+__authoremail__ = "vangils.dennis@gmail.com"
+__url__ = "https://github.com/Dennis-van-Gils/project-Arduino-trigger-box"
+__date__ = "14-10-2026"
+__version__ = "2.0.0"
+
+import ctypes
+import os
+import re
+import sys
+from pathlib import Path
+
+
+class Record(ctypes.Structure):
+    """Decoded telemetry record, mirroring `tb_record` in `trigger_box.h`."""
+
+    _fields_ = [
+        ("ticks", ctypes.c_uint64),
+        ("t_host", ctypes.c_double),
+        ("pulse_idx", ctypes.c_uint32),
+        ("type", ctypes.c_uint8),
+        ("outputs", ctypes.c_uint8),
+        ("seq", ctypes.c_uint8),
+        ("reserved", ctypes.c_uint8),
+    ]
+
+
+class Stats(ctypes.Structure):
+    """Mirrors `tb_stats` in `trigger_box.h`."""
+
+    _fields_ = [
+        ("records", ctypes.c_uint64),
+        ("lost", ctypes.c_uint64),
+        ("crc_errors", ctypes.c_uint64),
+        ("dropped", ctypes.c_uint64),
+        ("overflows", ctypes.c_uint64),
+        ("restarts", ctypes.c_uint64),
+    ]
+
+
+# Layout of `Record` for `numpy.frombuffer()`
+RECORD_DTYPE = [
+    ("ticks", "<u8"),
+    ("t_host", "<f8"),
+    ("pulse_idx", "<u4"),
+    ("type", "u1"),
+    ("outputs", "u1"),
+    ("seq", "u1"),
+    ("reserved", "u1"),
+]
+
+RECORD_CB = ctypes.CFUNCTYPE(None, ctypes.POINTER(Record), ctypes.c_void_p)
+TEXT_CB = ctypes.CFUNCTYPE(
+    None, ctypes.POINTER(ctypes.c_char), ctypes.c_size_t, ctypes.c_void_p
+)
+
+
+def _load_library():
+    if sys.platform.startswith("win"):
+        names = ["trigger_box.dll"]
+    elif sys.platform == "darwin":
+        names = ["libtrigger_box.dylib"]
+    else:
+        names = ["libtrigger_box.so"]
+
+    here = Path(__file__).resolve().parent
+    candidates = []
+    if "TRIGGER_BOX_LIB" in os.environ:
+        candidates.append(Path(os.environ["TRIGGER_BOX_LIB"]))
+    for folder in (here, here.parent / "build", here.parent / "build" / "Release"):
+        candidates += [folder / name for name in names]
+
+    for path in candidates:
+        if path.is_file():
+            lib = ctypes.CDLL(str(path))
+            break
+    else:
+        raise OSError("Trigger box host library not found, build `src_host`")
+
+    lib.tb_parser_new.restype = ctypes.c_void_p
+    lib.tb_parser_new.argtypes = [ctypes.c_double, ctypes.c_size_t]
+    lib.tb_parser_free.restype = None
+    lib.tb_parser_free.argtypes = [ctypes.c_void_p]
+    lib.tb_parser_feed.restype = ctypes.c_size_t
+    lib.tb_parser_feed.argtypes = [
+        ctypes.c_void_p,
+        ctypes.c_char_p,
+        ctypes.c_size_t,
+        ctypes.c_double,
+    ]
+    lib.tb_parser_pop.restype = ctypes.c_size_t
+    lib.tb_parser_pop.argtypes = [
+        ctypes.c_void_p,
+        ctypes.POINTER(Record),
+        ctypes.c_size_t,
+    ]
+    lib.tb_parser_set_record_cb.restype = None
+    lib.tb_parser_set_record_cb.argtypes = [
+        ctypes.c_void_p,
+        RECORD_CB,
+        ctypes.c_void_p,
+    ]
+    lib.tb_parser_set_text_cb.restype = None
+    lib.tb_parser_set_text_cb.argtypes = [
+        ctypes.c_void_p,
+        TEXT_CB,
+        ctypes.c_void_p,
+    ]
+    lib.tb_parser_stats.restype = None
+    lib.tb_parser_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(Stats)]
+    lib.tb_parser_to_host.restype = ctypes.c_double
+    lib.tb_parser_to_host.argtypes = [ctypes.c_void_p, ctypes.c_uint64]
+    lib.tb_parser_drift_ppm.restype = ctypes.c_double
+    lib.tb_parser_drift_ppm.argtypes = [ctypes.c_void_p]
+    lib.tb_host_now.restype = ctypes.c_double
+    lib.tb_host_now.argtypes = []
+
+    return lib
+
+
+_lib = _load_library()
+
+
+def host_now():
+    """Monotonic host clock [s], the time base of `Record.t_host`."""
+    return _lib.tb_host_now()
+
+
+class Parser:
+    """Picks the telemetry records out of the bytes read from the serial port
+    and reconstructs the host time of each pulse.
+
+    Args:
+        f_tick (float): Tick rate of the device [Hz], as reported by `?`.
+        queue_len (int): Number of records to queue until `pop()`.
+    """
+
+    def __init__(self, f_tick, queue_len=4096):
+        self._p = _lib.tb_parser_new(f_tick, queue_len)
+        if not self._p:
+            raise ValueError("Invalid tick rate or queue length")
+        self._buf = (Record * 1024)()
+        self._record_cb = None
+        self._text_cb = None
+
+    def __del__(self):
+        if getattr(self, "_p", None):
+            _lib.tb_parser_free(self._p)
+            self._p = None
+
+    def feed(self, data, t_host=None):
+        """Parse the bytes `data`, received at host time `t_host` [s] as by
+        `host_now()`, or now. Returns the number of records decoded."""
+        return _lib.tb_parser_feed(
+            self._p, bytes(data), len(data), -1.0 if t_host is None else t_host
+        )
+
+    def pop(self, max_records=1024):
+        """Take up to `max_records` records out of the queue. Returns a ctypes
+        array of `Record`, which gets reused by the next call."""
+        if max_records > len(self._buf):
+            self._buf = (Record * max_records)()
+        n = _lib.tb_parser_pop(self._p, self._buf, max_records)
+        return (Record * n).from_buffer(self._buf)
+
+    def on_record(self, fn):
+        """Call `fn(record)` from `feed()` for each record, instead of queueing
+        them. The record is only valid during the call. Pass None to queue
+        again."""
+        if fn is None:
+            self._record_cb = None
+            _lib.tb_parser_set_record_cb(self._p, RECORD_CB(), None)
+        else:
+            self._record_cb = RECORD_CB(lambda rec, user: fn(rec.contents))
+            _lib.tb_parser_set_record_cb(self._p, self._record_cb, None)
+
+    def on_text(self, fn):
+        """Call `fn(line)` from `feed()` for each text line, as a str."""
+        if fn is None:
+            self._text_cb = None
+            _lib.tb_parser_set_text_cb(self._p, TEXT_CB(), None)
+        else:
+            self._text_cb = TEXT_CB(
+                lambda line, n, user: fn(
+                    ctypes.string_at(line, n).decode("utf-8", "replace")
+                )
+            )
+            _lib.tb_parser_set_text_cb(self._p, self._text_cb, None)
+
+    @property
+    def stats(self):
+        stats = Stats()
+        _lib.tb_parser_stats(self._p, ctypes.byref(stats))
+        return stats
+
+    @property
+    def drift_ppm(self):
+        """Estimated rate error of the device oscillator [ppm]."""
+        return _lib.tb_parser_drift_ppm(self._p)
+
+    def to_host(self, ticks):
+        """Host time [s] of device time `ticks`."""
+        return _lib.tb_parser_to_host(self._p, ticks)
+
+
+class TriggerBox:
+    """Trigger box on a serial port, like a `serial.Serial` of pyserial. Asks
+    the device for its tick rate with `?` on construction."""
+
+    def __init__(self, port, queue_len=4096):
+        self.port = port
+        self.lines = []  # Text lines received
+        self._f_tick = None
+
+        self.send("?")
+        t_end = host_now() + 2
+        while (self._f_tick is None) and (host_now() < t_end):
+            line = port.readline().decode("utf-8", "replace")
+            match = re.search(r"f_tick\s*=\s*(\d+)", line)
+            if match:
+                self._f_tick = float(match.group(1))
+        if self._f_tick is None:
+            raise IOError("No reply from the trigger box")
+        port.reset_input_buffer()
+
+        self.parser = Parser(self._f_tick, queue_len)
+        self.parser.on_text(self.lines.append)
+
+    def send(self, cmd):
+        self.port.write((cmd + "\n").encode())
+
+    def poll(self):
+        """Read what came in and return the records decoded so far."""
+        n = self.port.in_waiting
+        if n:
+            self.parser.feed(self.port.read(n))
+        return self.parser.pop()
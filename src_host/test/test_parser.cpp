@@ -0,0 +1,291 @@
+/*------------------------------------------------------------------------------
+Tests of the host library
+
+Feeds synthetic telemetry through `Parser` and checks the framing, the link
+statistics and the clock model, by
+
+  ctest --test-dir src_host/build
+
+Each failing check gets printed with its line number, and the exit code is the
+number of failures.
+
+Dennis van Gils
+14-10-2026
+------------------------------------------------------------------------------*/
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "trigger_box.hpp"
+
+using namespace trigger_box;
+
+static int n_failed = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      std::printf("FAIL line %d: %s\n", __LINE__, #cond);                      \
+      n_failed++;                                                              \
+    }                                                                          \
+  } while (0)
+
+/*------------------------------------------------------------------------------
+  Helpers
+------------------------------------------------------------------------------*/
+
+typedef std::vector<uint8_t> Bytes;
+
+// Record as packed by `telemetry_pack()` in `telemetry.h`
+static Bytes make_record(char type, uint8_t seq, uint32_t pulse_idx,
+                         uint64_t ticks, uint8_t outputs = 0x01) {
+  Bytes rec(RECORD_LEN);
+
+  rec[0] = SYNC;
+  rec[1] = (uint8_t)type;
+  rec[2] = outputs;
+  rec[3] = seq;
+  for (size_t i = 0; i < 4; i++) {
+    rec[4 + i] = (uint8_t)(pulse_idx >> (8 * i));
+  }
+  for (size_t i = 0; i < 8; i++) {
+    rec[8 + i] = (uint8_t)(ticks >> (8 * i));
+  }
+  rec[16] = crc8(rec.data(), RECORD_LEN - 1);
+
+  return rec;
+}
+
+static void append(Bytes &dest, const Bytes &src) {
+  dest.insert(dest.end(), src.begin(), src.end());
+}
+
+static void append(Bytes &dest, const char *text) {
+  dest.insert(dest.end(), text, text + std::string(text).size());
+}
+
+static std::vector<Record> pop_all(Parser &parser) {
+  std::vector<Record> recs(1024);
+
+  recs.resize(parser.pop(recs.data(), recs.size()));
+  return recs;
+}
+
+/*------------------------------------------------------------------------------
+  Tests
+------------------------------------------------------------------------------*/
+
+static void test_record_fields() {
+  Parser parser(1e6);
+  Bytes data = make_record('P', 7, 123456, 0x0102030405060708ULL, 0x03);
+
+  CHECK(parser.feed(data.data(), data.size(), 1.0) == 1);
+  std::vector<Record> recs = pop_all(parser);
+  CHECK(recs.size() == 1);
+  CHECK(recs[0].type == 'P');
+  CHECK(recs[0].outputs == 0x03);
+  CHECK(recs[0].seq == 7);
+  CHECK(recs[0].pulse_idx == 123456);
+  CHECK(recs[0].ticks == 0x0102030405060708ULL);
+  CHECK(!std::isnan(recs[0].t_host));
+}
+
+static void test_text_lines() {
+  Parser parser(1e6);
+  std::vector<std::string> lines;
+  Bytes data;
+
+  parser.on_text([&lines](const std::string &line) { lines.push_back(line); });
+  append(data, "Pulse train started.\r\n");
+  append(data, make_record('P', 0, 0, 100));
+  append(data, "Pulse train stopped.\r\n");
+  parser.feed(data.data(), data.size(), 1.0);
+
+  CHECK(lines.size() == 2);
+  CHECK(lines.size() == 2 && lines[0] == "Pulse train started.");
+  CHECK(lines.size() == 2 && lines[1] == "Pulse train stopped.");
+  CHECK(pop_all(parser).size() == 1);
+}
+
+static void test_crc_rejection() {
+  Parser parser(1e6);
+  Bytes data = make_record('P', 0, 0, 100);
+  Bytes good = make_record('P', 1, 1, 200);
+
+  data[10] ^= 0x40; // Corrupt the time
+  append(data, good);
+  parser.feed(data.data(), data.size(), 1.0);
+
+  std::vector<Record> recs = pop_all(parser);
+  CHECK(parser.stats().crc_errors == 1);
+  CHECK(parser.stats().records == 1);
+  CHECK(recs.size() == 1 && recs[0].ticks == 200);
+}
+
+static void test_resync() {
+  // A record cut short swallows the start of the next one, which has to be
+  // found again at its sync byte
+  Parser parser(1e6);
+  Bytes data = make_record('P', 0, 0, 100);
+  Bytes good = make_record('P', 1, 1, 200);
+
+  data.resize(5);
+  append(data, good);
+  parser.feed(data.data(), data.size(), 1.0);
+
+  std::vector<Record> recs = pop_all(parser);
+  CHECK(parser.stats().crc_errors == 1);
+  CHECK(recs.size() == 1 && recs[0].pulse_idx == 1 && recs[0].ticks == 200);
+}
+
+static void test_sync_after_bare_bytes() {
+  // The upload handshake sends a bare ACK or NAK, without a line ending
+  Parser parser(1e6);
+  std::vector<std::string> lines;
+  Bytes data;
+
+  parser.on_text([&lines](const std::string &line) { lines.push_back(line); });
+  data.push_back(0x06);
+  append(data, make_record('P', 0, 0, 100));
+  data.push_back(0x15);
+  append(data, make_record('P', 1, 1, 200));
+  append(data, "  SQ     = ISR");
+  append(data, make_record('P', 2, 2, 300));
+  parser.feed(data.data(), data.size(), 1.0);
+
+  CHECK(pop_all(parser).size() == 3);
+  CHECK(parser.stats().crc_errors == 0);
+  CHECK(lines.size() == 1 && lines[0] == "  SQ     = ISR");
+}
+
+static void test_split_feeds() {
+  Parser parser(1e6);
+  Bytes data = make_record('P', 0, 0, 100);
+
+  append(data, make_record('P', 1, 1, 200));
+  for (size_t i = 0; i < data.size(); i++) {
+    parser.feed(&data[i], 1, 1.0);
+  }
+  CHECK(pop_all(parser).size() == 2);
+}
+
+static void test_seq_loss() {
+  Parser parser(1e6);
+  Bytes data;
+  const uint8_t seqs[] = {0, 1, 4, 5, 254, 255, 0, 1};
+
+  for (size_t i = 0; i < sizeof(seqs); i++) {
+    append(data, make_record('P', seqs[i], (uint32_t)i, 100 * (i + 1)));
+  }
+  parser.feed(data.data(), data.size(), 1.0);
+
+  // 2 and 3, then 6 to 253
+  CHECK(parser.stats().lost == 2 + 248);
+  CHECK(parser.stats().records == sizeof(seqs));
+}
+
+static void test_dropped() {
+  Parser parser(1e6);
+  Bytes data = make_record('D', 0, 7, 0);
+
+  append(data, make_record('D', 1, 5, 0));
+  parser.feed(data.data(), data.size(), 1.0);
+
+  std::vector<Record> recs = pop_all(parser);
+  CHECK(parser.stats().dropped == 12);
+  CHECK(recs.size() == 2 && recs[0].type == 'D');
+  CHECK(std::isnan(recs[0].t_host));
+}
+
+static void test_restart() {
+  Parser parser(1e6);
+  Bytes data;
+
+  append(data, make_record('P', 0, 0, 1000));
+  append(data, make_record('P', 1, 1, 2000));
+  append(data, make_record('P', 2, 0, 50)); // New pulse train
+  append(data, make_record('P', 3, 1, 1050));
+  parser.feed(data.data(), data.size(), 1.0);
+
+  CHECK(parser.stats().restarts == 2);
+}
+
+static void test_overflow() {
+  Parser parser(1e6, 4);
+  Bytes data;
+
+  for (uint8_t i = 0; i < 6; i++) {
+    append(data, make_record('P', i, i, 100 * (i + 1)));
+  }
+  parser.feed(data.data(), data.size(), 1.0);
+
+  CHECK(pop_all(parser).size() == 4);
+  CHECK(parser.stats().overflows == 2);
+}
+
+static void test_clock_fit() {
+  // Device oscillator running 50 ppm fast, pulses every 10 msec for 200 s,
+  // each arriving after a latency of 0.1 msec plus up to 2 msec of jitter
+  const double f_tick = 48e6;
+  const double drift = 50e-6;
+  const double offset = 1000.0; // Host time of device time 0 [s]
+  const double latency = 1e-4;  // Minimum latency of the link [s]
+  Parser parser(f_tick);
+  uint32_t lcg = 12345;
+  double worst = 0;             // Worst error of the host time [s]
+
+  for (uint32_t i = 0; i < 20000; i++) {
+    uint64_t ticks = (uint64_t)i * 480000;
+    double t_edge = offset + ticks / f_tick / (1 + drift);
+    double jitter;
+    Bytes rec = make_record('P', (uint8_t)i, i, ticks);
+
+    lcg = lcg * 1103515245 + 12345;
+    jitter = ((lcg >> 16) & 0x7FFF) / 32768.0 * 2e-3;
+    parser.feed(rec.data(), rec.size(), t_edge + latency + jitter);
+
+    std::vector<Record> recs = pop_all(parser);
+    if ((i >= 10000) && (recs.size() == 1)) {
+      double err = std::fabs(recs[0].t_host - (t_edge + latency));
+      worst = (err > worst) ? err : worst;
+    }
+  }
+
+  CHECK(std::fabs(parser.clock().drift_ppm() - 50) < 1);
+  CHECK(worst < 1e-4);
+  CHECK(std::fabs(parser.to_host(0) - (offset + latency)) < 1e-3);
+}
+
+static void test_c_api() {
+  tb_parser *p = tb_parser_new(1e6, 16);
+  Bytes data = make_record('P', 0, 0, 100);
+  tb_record rec;
+  tb_stats stats;
+
+  CHECK(tb_parser_new(0, 16) == nullptr);
+  CHECK(tb_parser_feed(p, data.data(), data.size(), 1.0) == 1);
+  CHECK(tb_parser_pop(p, &rec, 1) == 1 && rec.ticks == 100);
+  tb_parser_stats(p, &stats);
+  CHECK(stats.records == 1);
+  tb_parser_free(p);
+}
+
+int main() {
+  test_record_fields();
+  test_text_lines();
+  test_crc_rejection();
+  test_resync();
+  test_sync_after_bare_bytes();
+  test_split_feeds();
+  test_seq_loss();
+  test_dropped();
+  test_restart();
+  test_overflow();
+  test_clock_fit();
+  test_c_api();
+
+  std::printf("%s: %d check(s) failed\n", n_failed ? "FAILED" : "OK", n_failed);
+  return n_failed;
+}
@@ -0,0 +1,358 @@
+/*------------------------------------------------------------------------------
+Arduino trigger box, host library
+
+Record framing, clock model and C API of the host library, see
+`trigger_box.hpp` and `trigger_box.h`.
+
+Dennis van Gils
+14-10-2026
+------------------------------------------------------------------------------*/
+
+#include "trigger_box.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace trigger_box {
+
+/*------------------------------------------------------------------------------
+  Helpers
+------------------------------------------------------------------------------*/
+
+// CRC-8 with polynomial 0x07 and initial value 0, as `crc8()` in `telemetry.h`
+uint8_t crc8(const uint8_t *data, size_t len) {
+  uint8_t crc = 0;
+
+  while (len--) {
+    crc ^= *data++;
+    for (uint8_t i = 0; i < 8; i++) {
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+  }
+
+  return crc;
+}
+
+static uint64_t read_le(const uint8_t *buf, size_t len) {
+  uint64_t value = 0;
+
+  for (size_t i = 0; i < len; i++) {
+    value |= (uint64_t)buf[i] << (8 * i);
+  }
+
+  return value;
+}
+
+double host_now() {
+  using namespace std::chrono;
+  return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+/*------------------------------------------------------------------------------
+  ClockSync
+------------------------------------------------------------------------------*/
+
+void ClockSync::reset() {
+  _minima.clear();
+  _win_open = false;
+  _valid = false;
+  _a = 0;
+  _b = 0;
+}
+
+void ClockSync::add(double t_dev, double t_host) {
+  double y = t_host - t_dev;
+
+  if (!_win_open) {
+    _win = {t_dev, y};
+    _win_start = t_dev;
+    _win_open = true;
+  } else if (y < _win.y) {
+    _win = {t_dev, y};
+  }
+
+  if (t_dev - _win_start >= _window) {
+    _minima.push_back(_win);
+    if (_minima.size() > _n_windows) {
+      _minima.pop_front();
+    }
+    _win_open = false;
+    fit();
+  } else if (_minima.empty()) {
+    // No window completed yet: Best guess is the offset without drift
+    _a = _win.y;
+    _b = 0;
+    _valid = true;
+  }
+}
+
+void ClockSync::fit() {
+  double md = 0; // Mean device time
+  double my = 0; // Mean host minus device time
+  double sxx = 0;
+  double sxy = 0;
+
+  for (const Point &pt : _minima) {
+    md += pt.d;
+    my += pt.y;
+  }
+  md /= _minima.size();
+  my /= _minima.size();
+
+  for (const Point &pt : _minima) {
+    sxx += (pt.d - md) * (pt.d - md);
+    sxy += (pt.d - md) * (pt.y - my);
+  }
+
+  _b = (sxx > 0) ? sxy / sxx : 0;
+  _a = my - _b * md;
+  _valid = true;
+}
+
+double ClockSync::to_host(double t_dev) const {
+  return _valid ? t_dev + _a + _b * t_dev : NAN;
+}
+
+double ClockSync::drift_ppm() const {
+  // The host sees (1 + b) seconds pass per nominal second of the device
+  return (1 / (1 + _b) - 1) * 1e6;
+}
+
+/*------------------------------------------------------------------------------
+  RecordQueue
+------------------------------------------------------------------------------*/
+
+RecordQueue::RecordQueue(size_t capacity) {
+  size_t n = 1;
+
+  while (n < capacity) {
+    n <<= 1;
+  }
+  _buf.resize(n);
+  _mask = n - 1;
+}
+
+bool RecordQueue::push(const Record &rec) {
+  size_t head = _head.load(std::memory_order_relaxed);
+
+  if (head - _tail.load(std::memory_order_acquire) > _mask) {
+    return false;
+  }
+
+  _buf[head & _mask] = rec;
+  _head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+size_t RecordQueue::pop(Record *out, size_t max) {
+  size_t tail = _tail.load(std::memory_order_relaxed);
+  size_t n = _head.load(std::memory_order_acquire) - tail;
+
+  if (n > max) {
+    n = max;
+  }
+  for (size_t i = 0; i < n; i++) {
+    out[i] = _buf[(tail + i) & _mask];
+  }
+
+  _tail.store(tail + n, std::memory_order_release);
+  return n;
+}
+
+/*------------------------------------------------------------------------------
+  Parser
+------------------------------------------------------------------------------*/
+
+Parser::Parser(double f_tick, size_t queue_len)
+    : _f_tick(f_tick), _queue(queue_len) {}
+
+size_t Parser::feed(const uint8_t *data, size_t len, double t_host) {
+  size_t n_records = 0;
+
+  if (t_host < 0) {
+    t_host = host_now();
+  }
+  for (size_t i = 0; i < len; i++) {
+    parse_byte(data[i], t_host, n_records);
+  }
+
+  return n_records;
+}
+
+void Parser::parse_byte(uint8_t c, double t_host, size_t &n_records) {
+  if (_n_rec) {
+    _rec[_n_rec++] = c;
+    if (_n_rec < RECORD_LEN) {
+      return;
+    }
+
+    if (crc8(_rec, RECORD_LEN - 1) == _rec[RECORD_LEN - 1]) {
+      handle_record(t_host);
+      n_records++;
+      _n_rec = 0;
+      return;
+    }
+
+    // Resynchronize at the next sync byte, if any
+    _stats.crc_errors++;
+    _n_rec = 0;
+    for (size_t k = 1; k < RECORD_LEN; k++) {
+      if (_rec[k] == SYNC) {
+        _n_rec = RECORD_LEN - k;
+        std::memmove(_rec, &_rec[k], _n_rec);
+        break;
+      }
+    }
+    return;
+  }
+
+  if (c == SYNC) {
+    // Text never holds the sync byte, so what preceded it was no complete
+    // line: A bare handshake byte of an upload, which gets dropped, or text
+    // without its line ending, which gets passed on as is
+    if (_line_text) {
+      end_line();
+    }
+    _line.clear();
+    _rec[0] = c;
+    _n_rec = 1;
+    return;
+  }
+
+  if (c == '\n') {
+    end_line();
+  } else if (_line.size() < LINE_MAX) {
+    _line += (char)c;
+    _line_text |= (c >= ' ') && (c != 0x7F);
+  }
+}
+
+void Parser::end_line() {
+  if (!_line.empty() && (_line.back() == '\r')) {
+    _line.pop_back();
+  }
+  if (_on_text) {
+    _on_text(_line);
+  }
+  _line.clear();
+  _line_text = false;
+}
+
+void Parser::handle_record(double t_host) {
+  Record rec;
+
+  rec.type = _rec[1];
+  rec.outputs = _rec[2];
+  rec.seq = _rec[3];
+  rec.pulse_idx = (uint32_t)read_le(&_rec[4], 4);
+  rec.ticks = read_le(&_rec[8], 8);
+  rec.t_host = NAN;
+  rec.reserved = 0;
+
+  _stats.records++;
+  if (_have_seq) {
+    _stats.lost += (uint8_t)(rec.seq - _last_seq - 1);
+  }
+  _last_seq = rec.seq;
+  _have_seq = true;
+
+  switch (rec.type) {
+    case 'P':
+      // The device time restarts from 0 with each pulse train
+      if (_have_pulse &&
+          ((rec.ticks < _last_ticks) || (rec.pulse_idx < _last_idx))) {
+        _clock.reset();
+        _stats.restarts++;
+      } else if (!_have_pulse) {
+        _stats.restarts++;
+      }
+      _last_ticks = rec.ticks;
+      _last_idx = rec.pulse_idx;
+      _have_pulse = true;
+
+      _clock.add(rec.ticks / _f_tick, t_host);
+      rec.t_host = _clock.to_host(rec.ticks / _f_tick);
+      break;
+
+    case 'D':
+      _stats.dropped += rec.pulse_idx;
+      break;
+
+    default:
+      break;
+  }
+
+  if (_on_record) {
+    _on_record(rec);
+  } else if (!_queue.push(rec)) {
+    _stats.overflows++;
+  }
+}
+
+double Parser::to_host(uint64_t ticks) const {
+  return _clock.to_host(ticks / _f_tick);
+}
+
+} // namespace trigger_box
+
+/*------------------------------------------------------------------------------
+  C API
+------------------------------------------------------------------------------*/
+
+using trigger_box::Parser;
+
+struct tb_parser {
+  tb_parser(double f_tick, size_t queue_len) : parser(f_tick, queue_len) {}
+  Parser parser;
+};
+
+tb_parser *tb_parser_new(double f_tick, size_t queue_len) {
+  if (!(f_tick > 0) || (queue_len == 0)) {
+    return nullptr;
+  }
+  return new tb_parser(f_tick, queue_len);
+}
+
+void tb_parser_free(tb_parser *p) { delete p; }
+
+size_t tb_parser_feed(tb_parser *p, const uint8_t *data, size_t len,
+                      double t_host) {
+  return p->parser.feed(data, len, t_host);
+}
+
+size_t tb_parser_pop(tb_parser *p, tb_record *out, size_t max) {
+  return p->parser.pop(out, max);
+}
+
+void tb_parser_set_record_cb(tb_parser *p, tb_record_cb cb, void *user) {
+  if (cb) {
+    p->parser.on_record([cb, user](const tb_record &rec) { cb(&rec, user); });
+  } else {
+    p->parser.on_record(nullptr);
+  }
+}
+
+void tb_parser_set_text_cb(tb_parser *p, tb_text_cb cb, void *user) {
+  if (cb) {
+    p->parser.on_text([cb, user](const std::string &line) {
+      cb(line.c_str(), line.size(), user);
+    });
+  } else {
+    p->parser.on_text(nullptr);
+  }
+}
+
+void tb_parser_stats(const tb_parser *p, tb_stats *stats) {
+  *stats = p->parser.stats();
+}
+
+double tb_parser_to_host(const tb_parser *p, uint64_t ticks) {
+  return p->parser.to_host(ticks);
+}
+
+double tb_parser_drift_ppm(const tb_parser *p) {
+  return p->parser.clock().drift_ppm();
+}
+
+double tb_host_now(void) { return trigger_box::host_now(); }
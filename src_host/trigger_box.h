@@ -0,0 +1,91 @@
+/*------------------------------------------------------------------------------
+Arduino trigger box, host library
+
+C API of the host library, for bindings to other languages, see
+`python/trigger_box.py`. The C++ API lives in `trigger_box.hpp`.
+
+The parser takes in the raw bytes as read from the serial port, picks out the
+binary telemetry records, see `src_mcu/src/telemetry.h`, and passes on the
+text lines in between. Each pulse record gets tagged with the host time of its
+edge, reconstructed from the 64-bit device time by a clock model that tracks
+the offset and the drift of the device oscillator w.r.t. the host clock.
+
+Dennis van Gils
+14-10-2026
+------------------------------------------------------------------------------*/
+
+#ifndef TRIGGER_BOX_H
+#define TRIGGER_BOX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A decoded telemetry record
+typedef struct tb_record {
+  uint64_t ticks;     // Device time since the start of the pulse train, or the
+                      // latency for type 'L' [ticks]
+  double t_host;      // Host time of the edge [s], NaN when not applicable
+  uint32_t pulse_idx; // Pulse index, or the count for type 'D'
+  uint8_t type;       // 'P': pulse, 'D': dropped, 'L': latency, 'A': ack
+  uint8_t outputs;    // Channel mask, or the command id for type 'A'
+  uint8_t seq;        // Sequence number as sent by the device
+  uint8_t reserved;
+} tb_record;
+
+typedef struct tb_stats {
+  uint64_t records;    // Records decoded
+  uint64_t lost;       // Records lost on the link, by the sequence numbers
+  uint64_t crc_errors; // Records discarded for a failing CRC
+  uint64_t dropped;    // Pulse events dropped by the device itself
+  uint64_t overflows;  // Records discarded because the queue was full
+  uint64_t restarts;   // Pulse trains started, each resetting the clock model
+} tb_stats;
+
+typedef struct tb_parser tb_parser;
+
+// Called from `tb_parser_feed()` for each record, which stays valid only for
+// the duration of the call
+typedef void (*tb_record_cb)(const tb_record *rec, void *user);
+
+// Called from `tb_parser_feed()` for each text line, without its CR LF
+typedef void (*tb_text_cb)(const char *line, size_t len, void *user);
+
+// New parser for a device ticking at `f_tick` Hz, as reported by its `?`
+// command, queueing up to `queue_len` records, rounded up to a power of two
+tb_parser *tb_parser_new(double f_tick, size_t queue_len);
+void tb_parser_free(tb_parser *p);
+
+// Parse `len` bytes received at host time `t_host` [s], as by `tb_host_now()`.
+// Pass a negative `t_host` to take the current time. Returns the number of
+// records decoded.
+size_t tb_parser_feed(tb_parser *p, const uint8_t *data, size_t len,
+                      double t_host);
+
+// Take up to `max` records out of the queue into `out`. Returns the number
+// taken. May be called from another thread than `tb_parser_feed()`.
+size_t tb_parser_pop(tb_parser *p, tb_record *out, size_t max);
+
+// Hand the records to `cb` instead of queueing them. Pass NULL to queue again.
+void tb_parser_set_record_cb(tb_parser *p, tb_record_cb cb, void *user);
+void tb_parser_set_text_cb(tb_parser *p, tb_text_cb cb, void *user);
+
+void tb_parser_stats(const tb_parser *p, tb_stats *stats);
+
+// Host time [s] of device time `ticks`, NaN before the first pulse
+double tb_parser_to_host(const tb_parser *p, uint64_t ticks);
+
+// Estimated rate error of the device oscillator: Positive when it runs fast
+double tb_parser_drift_ppm(const tb_parser *p);
+
+// Monotonic host clock [s]
+double tb_host_now(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
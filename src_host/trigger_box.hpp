@@ -0,0 +1,147 @@
+/*------------------------------------------------------------------------------
+Arduino trigger box, host library
+
+C++ API of the host library, see `trigger_box.h` for an overview.
+
+  * `ClockSync` maps the device time onto the host time. Each record only
+    reaches the host after a variable delay over USB, but never before its
+    edge. Hence, per window of `window` seconds of device time, the sample
+    with the smallest host-minus-device time is the one closest to the truth.
+    A least-squares line through the last `n_windows` of these minima gives
+    the offset and the drift. The offset includes the minimum link latency.
+  * `RecordQueue` is a lock-free single-producer/single-consumer FIFO, so that
+    a reader thread can feed the parser while the acquisition thread pops.
+  * `Parser` frames the bytes. Text never contains the sync byte, and the
+    device only sends records at the beginning of a line, so a sync byte
+    always starts a record. Bytes pending in front of it either were text
+    without its line ending, passed on as a line, or merely control bytes,
+    e.g. the handshake of an upload, which get dropped.
+
+Dennis van Gils
+14-10-2026
+------------------------------------------------------------------------------*/
+
+#ifndef TRIGGER_BOX_HPP
+#define TRIGGER_BOX_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "trigger_box.h"
+
+namespace trigger_box {
+
+constexpr uint8_t SYNC = 0xA5;
+constexpr size_t RECORD_LEN = 17;
+constexpr size_t LINE_MAX = 256; // Longer text lines get cut
+
+using Record = tb_record;
+using Stats = tb_stats;
+
+uint8_t crc8(const uint8_t *data, size_t len);
+
+class ClockSync {
+public:
+  explicit ClockSync(double window = 1.0, size_t n_windows = 64)
+      : _window(window), _n_windows(n_windows) {}
+
+  void reset();
+
+  // Add the device time `t_dev` [s] of an edge, received at `t_host` [s]
+  void add(double t_dev, double t_host);
+
+  // Host time of device time `t_dev` [s], NaN before the first sample
+  double to_host(double t_dev) const;
+
+  // Rate error of the device clock w.r.t. the host clock [ppm]
+  double drift_ppm() const;
+
+private:
+  struct Point {
+    double d; // Device time [s]
+    double y; // Host minus device time [s]
+  };
+
+  void fit();
+
+  double _window;
+  size_t _n_windows;
+  std::deque<Point> _minima; // Minimum of each completed window
+  Point _win{0, 0};          // Minimum of the current window so far
+  double _win_start = 0;     // Device time at which the current window opened
+  bool _win_open = false;
+  bool _valid = false;
+  double _a = 0; // Offset of the fit [s]
+  double _b = 0; // Slope of the fit
+};
+
+class RecordQueue {
+public:
+  explicit RecordQueue(size_t capacity);
+
+  // Producer: Returns false when the queue is full
+  bool push(const Record &rec);
+
+  // Consumer: Take up to `max` records into `out`
+  size_t pop(Record *out, size_t max);
+
+private:
+  std::vector<Record> _buf;
+  size_t _mask;
+  std::atomic<size_t> _head{0};
+  std::atomic<size_t> _tail{0};
+};
+
+class Parser {
+public:
+  using RecordCallback = std::function<void(const Record &)>;
+  using TextCallback = std::function<void(const std::string &)>;
+
+  explicit Parser(double f_tick, size_t queue_len = 4096);
+
+  // See `tb_parser_feed()`
+  size_t feed(const uint8_t *data, size_t len, double t_host);
+
+  size_t pop(Record *out, size_t max) { return _queue.pop(out, max); }
+
+  void on_record(RecordCallback cb) { _on_record = std::move(cb); }
+  void on_text(TextCallback cb) { _on_text = std::move(cb); }
+
+  const Stats &stats() const { return _stats; }
+  const ClockSync &clock() const { return _clock; }
+  double to_host(uint64_t ticks) const;
+
+private:
+  void parse_byte(uint8_t c, double t_host, size_t &n_records);
+  void handle_record(double t_host);
+  void end_line();
+
+  double _f_tick;
+  ClockSync _clock;
+  RecordQueue _queue;
+  RecordCallback _on_record;
+  TextCallback _on_text;
+  Stats _stats{};
+
+  uint8_t _rec[RECORD_LEN]; // Record being received
+  size_t _n_rec = 0;        // Number of bytes in `_rec`
+  std::string _line;        // Text line being received
+  bool _line_text = false;  // Does `_line` hold any printable character?
+  bool _have_seq = false;
+  uint8_t _last_seq = 0;
+  uint64_t _last_ticks = 0;
+  uint32_t _last_idx = 0;
+  bool _have_pulse = false;
+};
+
+// Monotonic host clock [s]
+double host_now();
+
+} // namespace trigger_box
+
+#endif
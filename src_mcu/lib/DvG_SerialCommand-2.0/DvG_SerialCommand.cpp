@@ -4,51 +4,217 @@ Dennis van Gils, 11-03-2020
 
 #include "DvG_SerialCommand.h"
 
+// CRC-8 with polynomial 0x07, continuing from 'crc'
+static uint8_t crc8(uint8_t crc, const uint8_t* data, uint8_t len) {
+  while (len--) {
+    crc ^= *data++;
+    for (uint8_t i = 0; i < 8; i++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+    }
+  }
+  return crc;
+}
+
 DvG_SerialCommand::DvG_SerialCommand(Stream& mySerial) :
 _port(mySerial)   // Initialise reference before body
 {
   _strIn[0] = '\0';
   _fTerminated = false;
   _iPos = 0;
+  _carry = -1;
+  _fFrame = false;
+  _frameLen = 0;
+  _tFrame = 0;
+  _nFrameErrors = 0;
+  _nOverruns = 0;
+  _upDest = NULL;
+  _upSize = 0;
+  _upPos = 0;
+  _upCrc = 0;
+  _tUpload = 0;
+  _fUploadDone = false;
+  _fUploadOk = false;
 }
 
 bool DvG_SerialCommand::available() {
-  char c;
+  if (_fTerminated) {
+    // The previous command has not been retrieved yet
+    return true;
+  }
 
-  // Poll serial buffer
-  if (_port.available()) {
-    _fTerminated = false;
-    while (_port.available()) {
-      c = _port.peek();
-      if (c == 13) {
-        // Ignore ASCII 13 (carriage return)
-        _port.read();             // Remove char from serial buffer
-      } else if (c == 10) {
-        // Found the proper termination character ASCII 10 (line feed)
-        _port.read();             // Remove char from serial buffer
-        _strIn[_iPos] = '\0';     // Terminate string
-        _fTerminated = true;
-        break;
-      } else if (_iPos < STR_LEN - 1) {
-        // Maximum length of incoming serial command is not yet reached. Append
-        // characters to string.
-        _port.read();             // Remove char from serial buffer
-        _strIn[_iPos] = c;
-        _iPos++;
-      } else {
-        // Maximum length of incoming serial command is reached. Forcefully
-        // terminate string now. Leave the char in the serial buffer.
-        _strIn[_iPos] = '\0';     // Terminate string
-        _fTerminated = true;
-        break;
-      }
+  if (_upDest) {
+    return _pollUpload();
+  }
+
+  if (_fFrame) {
+    return _pollFrame();
+  }
+
+  if (_carry >= 0) {
+    int c = _carry;
+    _carry = -1;
+    if (_processChar(c)) {
+      return true;
+    }
+  }
+
+  // Poll serial buffer. A single read() per char, instead of a peek() followed
+  // by a read().
+  while (!_fFrame && _port.available()) {
+    if (_processChar(_port.read())) {
+      return true;
     }
   }
+
+  return _fFrame && _pollFrame();
+}
+
+bool DvG_SerialCommand::_processChar(int c) {
+  if (c == 13) {
+    // Ignore ASCII 13 (carriage return)
+  } else if (c == 10) {
+    // Found the proper termination character ASCII 10 (line feed)
+    _strIn[_iPos] = '\0';       // Terminate string
+    _fTerminated = true;
+  } else if ((c == SC_FRAME_SYNC) && (_iPos == 0)) {
+    // Start of a binary frame
+    _fFrame = true;
+    _frameLen = 0;
+    _tFrame = millis();
+  } else if (_iPos < STR_LEN - 1) {
+    // Maximum length of incoming serial command is not yet reached. Append
+    // characters to string.
+    _strIn[_iPos] = c;
+    _iPos++;
+  } else {
+    // Maximum length of incoming serial command is reached. Forcefully
+    // terminate string now. Keep the char for the next command.
+    _strIn[_iPos] = '\0';       // Terminate string
+    _fTerminated = true;
+    _carry = c;
+    _nOverruns++;
+  }
   return _fTerminated;
 }
 
+bool DvG_SerialCommand::_pollFrame() {
+  int n;
+
+  if (_frameLen == 0) {
+    if (!_port.available()) {
+      if (millis() - _tFrame > SC_FRAME_TIMEOUT) {
+        _abortFrame();
+      }
+      return false;
+    }
+    _frameLen = _port.read();
+    if ((_frameLen == 0) || (_frameLen > STR_LEN - 1)) {
+      _abortFrame();
+      return false;
+    }
+  }
+
+  // Bulk-read the payload and the CRC, but only as far as available, so that
+  // readBytes() never has to wait for its timeout
+  n = _port.available();
+  if (n > _frameLen + 1 - _iPos) {
+    n = _frameLen + 1 - _iPos;
+  }
+  if (n > 0) {
+    _iPos += _port.readBytes(&_strIn[_iPos], n);
+  }
+
+  if (_iPos < _frameLen + 1) {
+    if (millis() - _tFrame > SC_FRAME_TIMEOUT) {
+      _abortFrame();
+    }
+    return false;
+  }
+
+  if (crc8(crc8(0, &_frameLen, 1), (uint8_t*) _strIn, _frameLen) !=
+      (uint8_t) _strIn[_frameLen]) {
+    _abortFrame();
+    return false;
+  }
+
+  _fTerminated = true;
+  return true;
+}
+
+void DvG_SerialCommand::_abortFrame() {
+  _fFrame = false;
+  _frameLen = 0;
+  _iPos = 0;
+  _nFrameErrors++;
+}
+
+void DvG_SerialCommand::beginUpload(uint8_t* dest, uint16_t size) {
+  _upDest = dest;
+  _upSize = size;
+  _upPos = 0;
+  _upCrc = 0;
+  _tUpload = millis();
+  _fUploadDone = false;
+  _port.write(SC_UPLOAD_ACK);
+}
+
+bool DvG_SerialCommand::_pollUpload() {
+  int n = _port.available();
+
+  if (n == 0) {
+    if (millis() - _tUpload > SC_UPLOAD_TIMEOUT) {
+      _endUpload(false);
+      return true;
+    }
+    return false;
+  }
+  _tUpload = millis();
+
+  if (_upPos == _upSize) {
+    // All data is in, this is the CRC
+    _endUpload((uint8_t) _port.read() == _upCrc);
+    return true;
+  }
+
+  // Bulk-read straight into the destination, up to the end of the current
+  // chunk, and acknowledge each completed chunk
+  uint32_t chunk_end = ((uint32_t) _upPos / SC_UPLOAD_CHUNK + 1) *
+                       SC_UPLOAD_CHUNK;
+  if (chunk_end > _upSize) {
+    chunk_end = _upSize;
+  }
+  if (n > (int) (chunk_end - _upPos)) {
+    n = chunk_end - _upPos;
+  }
+  n = _port.readBytes((char*) &_upDest[_upPos], n);
+  _upCrc = crc8(_upCrc, &_upDest[_upPos], n);
+  _upPos += n;
+
+  if ((_upPos == chunk_end) && (_upPos < _upSize)) {
+    _port.write(SC_UPLOAD_ACK);
+  }
+  return false;
+}
+
+void DvG_SerialCommand::_endUpload(bool fSuccess) {
+  _upDest = NULL;
+  _fUploadOk = fSuccess && (_upPos == _upSize);
+  _fUploadDone = true;
+  _fTerminated = true;
+  _port.write(_fUploadOk ? SC_UPLOAD_ACK : SC_UPLOAD_NAK);
+}
+
+bool DvG_SerialCommand::getUpload() {
+  if (_fTerminated && _fUploadDone) {
+    _fTerminated = false;
+    _fUploadDone = false;
+    return _fUploadOk;
+  }
+  return false;
+}
+
 char* DvG_SerialCommand::getCmd() {
-  if (_fTerminated) {
+  if (_fTerminated && !_fFrame && !_fUploadDone) {
     _fTerminated = false;     // Reset incoming serial command char array
     _iPos = 0;                // Reset incoming serial command char array
     return (char*) _strIn;
@@ -57,6 +223,19 @@ char* DvG_SerialCommand::getCmd() {
   }
 }
 
+uint8_t* DvG_SerialCommand::getFrame(uint8_t& len) {
+  if (_fTerminated && _fFrame) {
+    _fTerminated = false;
+    _fFrame = false;
+    _iPos = 0;
+    len = _frameLen;
+    return (uint8_t*) _strIn;
+  } else {
+    len = 0;
+    return NULL;
+  }
+}
+
 /*------------------------------------------------------------------------------
     Parse float value at end of string 'strIn' starting at position 'iPos'
 ------------------------------------------------------------------------------*/
@@ -12,6 +12,28 @@ It doesn't matter if the command is ASCII or binary encoded.
 will return true when a new command is ready to be processed. Subsequently, the
 command string can be retrieved by calling 'getCmd()'.
 
+Alternatively, a command can be sent as a binary frame:
+
+    [SC_FRAME_SYNC] [len] [payload of len bytes] [CRC-8]
+
+A frame is recognized by the sync byte 0xA5 at the start of a command, which
+never occurs in ASCII text. The payload typically starts with a command id
+followed by the command data, and must fit in the buffer together with the
+CRC-8, i.e. 1 <= len <= STR_LEN - 1. The CRC-8 covers the length byte and the
+payload, with polynomial 0x07 and initial value 0. Frames that fail the CRC or
+that stall for longer than SC_FRAME_TIMEOUT get discarded and counted. Once
+'available()' returns true and 'isFrame()' tells that it concerns a frame, the
+payload can be retrieved by calling 'getFrame()'. The frame bytes get
+bulk-read from the serial port as far as they are available, so that a frame
+never blocks.
+
+Data too large for the buffer can be uploaded by streaming it straight into a
+destination buffer of the caller, see 'beginUpload()'. The host sends the data
+in chunks of SC_UPLOAD_CHUNK bytes, waiting for the SC_UPLOAD_ACK byte after
+each chunk before sending the next, and finishes with the CRC-8 over all data.
+The upload then gets acknowledged by SC_UPLOAD_ACK once more, or rejected by
+SC_UPLOAD_NAK on a failing CRC or a timeout of SC_UPLOAD_TIMEOUT.
+
 Dennis van Gils, 11-03-2020
 */
 
@@ -21,8 +43,19 @@ Dennis van Gils, 11-03-2020
 #include <Arduino.h>
 
 // Buffer size for storing incoming characters. Includes the '\0' termination
-// character. Change buffer size to your needs up to a maximum of 255.
+// character. Can be set by a build flag, e.g. `-D STR_LEN=256`, up to a maximum
+// of 65535. Binary frames use at most 256 bytes of it.
+#ifndef STR_LEN
 #define STR_LEN 32
+#endif
+
+#define SC_FRAME_SYNC 0xA5   // Start of a binary frame
+#define SC_FRAME_TIMEOUT 100 // [ms] Discard a frame stalling for this long
+
+#define SC_UPLOAD_CHUNK 64     // Bytes per acknowledged chunk of an upload
+#define SC_UPLOAD_ACK 0x06     // ASCII ACK
+#define SC_UPLOAD_NAK 0x15     // ASCII NAK
+#define SC_UPLOAD_TIMEOUT 1000 // [ms] Fail an upload stalling for this long
 
 class DvG_SerialCommand {
  public:
@@ -36,13 +69,76 @@ class DvG_SerialCommand {
   // an empty C-string.
   char* getCmd();
 
+  // Is the command that is ready a binary frame instead of a C-string?
+  bool isFrame() { return _fTerminated && _fFrame; }
+
+  // Return the payload of the incoming binary frame only when it is ready,
+  // with 'len' set to its length. Otherwise return NULL with 'len' set to 0.
+  uint8_t* getFrame(uint8_t& len);
+
+  // Number of binary frames discarded because of a failing CRC, an invalid
+  // length or a timeout
+  uint16_t getFrameErrors() { return _nFrameErrors; }
+
+  // Number of commands that got forcefully terminated because they exceeded
+  // the buffer size STR_LEN
+  uint16_t getOverruns() { return _nOverruns; }
+
+  // Start streaming an upload of exactly 'size' bytes into 'dest', which must
+  // stay valid until the upload has finished. Acknowledges the start by
+  // SC_UPLOAD_ACK. Meanwhile 'available()' consumes the incoming data, and
+  // returns true once the upload has finished.
+  void beginUpload(uint8_t* dest, uint16_t size);
+
+  // Has the command that is ready been the upload?
+  bool isUpload() { return _fTerminated && _fUploadDone; }
+
+  // Return true when the finished upload is complete and passed its CRC.
+  // Otherwise the contents of the destination are undefined.
+  bool getUpload();
+
+  // Number of bytes requested by the latest upload
+  uint16_t getUploadLen() { return _upSize; }
+
  private:
+  // Process a single incoming character. Return true if it terminated the
+  // command.
+  bool _processChar(int c);
+
+  // Bulk-read the available bytes of the binary frame. Return true if the frame
+  // is complete and valid.
+  bool _pollFrame();
+
+  // Discard the incoming binary frame
+  void _abortFrame();
+
+  // Consume the available bytes of the upload. Return true if it finished.
+  bool _pollUpload();
+
+  // Finish the upload, successful or not, and acknowledge it
+  void _endUpload(bool fSuccess);
+
   Stream& _port;              // Serial port reference
   char    _strIn[STR_LEN];    // Incoming serial command string
   bool    _fTerminated;       // Incoming serial command is/got terminated?
-  uint8_t _iPos;              // Index within _strIn to insert new char
+  uint16_t _iPos;             // Index within _strIn to insert new char
+  int     _carry;             // Char that did not fit anymore, -1 if none
   const char* _empty = "\0";  // Reply when trying to retrieve command when not
                               // yet terminated
+
+  bool     _fFrame;           // Is the incoming command a binary frame?
+  uint8_t  _frameLen;         // Payload length of the frame, 0 if not yet read
+  uint32_t _tFrame;           // Time at which the frame started [ms]
+  uint16_t _nFrameErrors;     // Number of discarded frames
+  uint16_t _nOverruns;        // Number of forcefully terminated commands
+
+  uint8_t* _upDest;           // Destination of the upload, NULL if none
+  uint16_t _upSize;           // Number of bytes to upload
+  uint16_t _upPos;            // Number of bytes uploaded so far
+  uint8_t  _upCrc;            // CRC-8 over the bytes uploaded so far
+  uint32_t _tUpload;          // Time of the latest progress [ms]
+  bool     _fUploadDone;      // Has the upload finished?
+  bool     _fUploadOk;        // Did it finish successfully?
 };
 
 /*------------------------------------------------------------------------------
@@ -0,0 +1,216 @@
+/*------------------------------------------------------------------------------
+DMA playback
+
+DMAC descriptors and TC4/TC5 step timer of the sequence playback, see
+`dma_playback.h`.
+
+Dennis van Gils
+14-10-2026
+------------------------------------------------------------------------------*/
+
+#ifdef _VARIANT_FEATHER_M4_
+
+#include "dma_playback.h"
+
+#define CH_PORT 0   // DMAC channel writing the output toggles
+#define CH_PERIOD 1 // DMAC channel writing the step durations
+
+static uint32_t toggles[SEQUENCE_LEN]; // Outputs to toggle at each step
+static uint32_t periods[SEQUENCE_LEN]; // Duration of the step after [ticks - 1]
+static uint16_t n_loaded = 0;          // Number of steps loaded
+
+// First descriptor (A) of each channel, its second (B), and the write-back
+// section. The DMAC requires each of them to be 16-byte aligned.
+static DmacDescriptor desc_A[2] __attribute__((aligned(16)));
+static DmacDescriptor desc_B[2] __attribute__((aligned(16)));
+static DmacDescriptor desc_wb[2] __attribute__((aligned(16)));
+
+static uint32_t repeats = 0;             // Times to play the table, 0: endless
+static volatile uint32_t passes = 0;     // Passes of the table completed
+static volatile bool f_running = false;  // Is the table being played back?
+static bool f_initialized = false;       // Are the DMAC and TC4 clocked?
+
+/*------------------------------------------------------------------------------
+  Hardware
+------------------------------------------------------------------------------*/
+
+static void dma_begin() {
+  // TC4 is the master of the 32-bit pair, TC5 its slave. Both share the same
+  // peripheral clock channel.
+  MCLK->AHBMASK.reg |= MCLK_AHBMASK_DMAC;
+  MCLK->APBCMASK.reg |= MCLK_APBCMASK_TC4 | MCLK_APBCMASK_TC5;
+  GCLK->PCHCTRL[TC4_GCLK_ID].reg = GCLK_PCHCTRL_GEN_GCLK1 | GCLK_PCHCTRL_CHEN;
+  while (!(GCLK->PCHCTRL[TC4_GCLK_ID].reg & GCLK_PCHCTRL_CHEN)) {}
+
+  DMAC->CTRL.bit.DMAENABLE = 0;
+  DMAC->CTRL.reg = DMAC_CTRL_SWRST;
+  while (DMAC->CTRL.bit.SWRST) {}
+  DMAC->BASEADDR.reg = (uint32_t)desc_A;
+  DMAC->WRBADDR.reg = (uint32_t)desc_wb;
+  DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE | DMAC_CTRL_LVLEN(0xF);
+
+  NVIC_ClearPendingIRQ(DMAC_0_IRQn);
+  NVIC_SetPriority(DMAC_0_IRQn, 1); // Just below the pulse engine
+  NVIC_EnableIRQ(DMAC_0_IRQn);
+
+  f_initialized = true;
+}
+
+static void tc_stop() {
+  TC4->COUNT32.CTRLA.bit.ENABLE = 0;
+  while (TC4->COUNT32.SYNCBUSY.bit.ENABLE) {}
+}
+
+static void channel_stop(uint8_t ch) {
+  DMAC->Channel[ch].CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+  while (DMAC->Channel[ch].CHCTRLA.reg & DMAC_CHCTRLA_ENABLE) {}
+}
+
+// Configure channel `ch` to move one word per overflow of TC4
+static void channel_begin(uint8_t ch, bool f_interrupt) {
+  channel_stop(ch);
+  DMAC->Channel[ch].CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+  while (DMAC->Channel[ch].CHCTRLA.reg & DMAC_CHCTRLA_SWRST) {}
+
+  DMAC->Channel[ch].CHCTRLA.reg = DMAC_CHCTRLA_TRIGSRC(TC4_DMAC_ID_OVF) |
+                                  DMAC_CHCTRLA_TRIGACT_BURST |
+                                  DMAC_CHCTRLA_BURSTLEN_SINGLE;
+  DMAC->Channel[ch].CHPRILVL.reg = DMAC_CHPRILVL_PRILVL(3); // Highest
+  DMAC->Channel[ch].CHINTFLAG.reg = DMAC_CHINTFLAG_TCMPL | DMAC_CHINTFLAG_TERR;
+  if (f_interrupt) {
+    DMAC->Channel[ch].CHINTENSET.reg = DMAC_CHINTENSET_TCMPL;
+  }
+}
+
+// A single pass of the table from `src` to the register `dst`, followed by
+// the descriptor `next`
+static void descriptor_set(DmacDescriptor &desc, const uint32_t *src,
+                           volatile uint32_t *dst, DmacDescriptor *next,
+                           bool f_interrupt) {
+  desc.BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_WORD |
+                    DMAC_BTCTRL_SRCINC |
+                    (f_interrupt ? DMAC_BTCTRL_BLOCKACT_INT
+                                 : DMAC_BTCTRL_BLOCKACT_NOACT);
+  desc.BTCNT.reg = n_loaded;
+  desc.SRCADDR.reg = (uint32_t)(src + n_loaded); // End address, as it counts up
+  desc.DSTADDR.reg = (uint32_t)dst;
+  desc.DESCADDR.reg = (uint32_t)next;
+}
+
+// Let pass `pass` of the table be the final one
+static void unlink_pass(uint32_t pass) {
+  DmacDescriptor *desc = (pass & 1) ? desc_B : desc_A;
+
+  desc[CH_PORT].DESCADDR.reg = 0;
+  desc[CH_PERIOD].DESCADDR.reg = 0;
+}
+
+// Entered at the end of each pass of the table
+void DMAC_0_Handler() {
+  DMAC->Channel[CH_PORT].CHINTFLAG.reg = DMAC_CHINTFLAG_TCMPL;
+  passes++;
+
+  if (!repeats) {
+    return;
+  }
+
+  if (passes >= repeats) {
+    tc_stop();
+    f_running = false;
+  } else if (passes + 2 == repeats) {
+    // The DMAC is now in the middle of pass `passes` and still has to fetch
+    // the descriptor of the next one, being the final one
+    unlink_pass(passes + 1);
+  }
+}
+
+/*------------------------------------------------------------------------------
+  Public
+------------------------------------------------------------------------------*/
+
+bool dma_playback_load(const SequenceStep *steps, uint16_t n_steps,
+                       const PortMask *level_ports, uint32_t repeats_) {
+  uint8_t all_channels = (1 << N_CHANNELS) - 1;
+  uint8_t level = 0;
+  uint64_t pass_ticks = 0;
+
+  if ((n_steps == 0) || (n_steps > SEQUENCE_LEN) ||
+      (steps[n_steps - 1].mask & all_channels) ||
+      level_ports[all_channels].port[1]) {
+    return false;
+  }
+
+  for (uint16_t i = 0; i < n_steps; i++) {
+    uint8_t next_level = steps[i].mask & all_channels;
+
+    if (steps[i].delta < DMA_MIN_TICKS) {
+      return false;
+    }
+    toggles[i] = level_ports[level ^ next_level].port[0];
+    periods[i] = steps[(i + 1) % n_steps].delta - 1;
+    pass_ticks += steps[i].delta;
+    level = next_level;
+  }
+
+  if ((repeats_ > 2) && (pass_ticks < DMA_MIN_PASS_TICKS)) {
+    return false;
+  }
+
+  if (!f_initialized) {
+    dma_begin();
+  }
+
+  dma_playback_stop();
+  n_loaded = n_steps;
+  repeats = repeats_;
+
+  for (uint8_t pass = 0; pass < 2; pass++) {
+    DmacDescriptor *desc = pass ? desc_B : desc_A;
+    DmacDescriptor *next = pass ? desc_A : desc_B;
+
+    descriptor_set(desc[CH_PORT], toggles, &PORT->Group[0].OUTTGL.reg,
+                   &next[CH_PORT], true);
+    descriptor_set(desc[CH_PERIOD], periods, &TC4->COUNT32.CCBUF[0].reg,
+                   &next[CH_PERIOD], false);
+  }
+  if (repeats && (repeats <= 2)) {
+    unlink_pass(repeats - 1);
+  }
+
+  // The counter starts off with the duration of the first step queued in its
+  // compare buffer
+  TC4->COUNT32.CTRLA.reg = TC_CTRLA_SWRST;
+  while (TC4->COUNT32.SYNCBUSY.bit.SWRST) {}
+  TC4->COUNT32.CTRLA.reg = TC_CTRLA_MODE_COUNT32 | TC_CTRLA_PRESCALER_DIV1;
+  TC4->COUNT32.WAVE.reg = TC_WAVE_WAVEGEN_MFRQ;
+  TC4->COUNT32.CCBUF[0].reg = steps[0].delta - 1;
+
+  return true;
+}
+
+void dma_playback_start(uint32_t lead) {
+  passes = 0;
+  f_running = true;
+
+  TC4->COUNT32.CC[0].reg = lead - 1;
+  while (TC4->COUNT32.SYNCBUSY.bit.CC0) {}
+
+  channel_begin(CH_PORT, true);
+  channel_begin(CH_PERIOD, false);
+  DMAC->Channel[CH_PORT].CHCTRLA.reg |= DMAC_CHCTRLA_ENABLE;
+  DMAC->Channel[CH_PERIOD].CHCTRLA.reg |= DMAC_CHCTRLA_ENABLE;
+
+  TC4->COUNT32.CTRLA.bit.ENABLE = 1;
+  while (TC4->COUNT32.SYNCBUSY.bit.ENABLE) {}
+}
+
+void dma_playback_stop() {
+  tc_stop();
+  channel_stop(CH_PORT);
+  channel_stop(CH_PERIOD);
+  f_running = false;
+}
+
+bool dma_playback_running() { return f_running; }
+
+#endif
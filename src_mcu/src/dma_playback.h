@@ -0,0 +1,71 @@
+/*------------------------------------------------------------------------------
+DMA playback
+
+Plays back a table of `SequenceStep`s on the Adafruit Feather M4 Express
+without any CPU involvement per step. Meant for patterns that are too fast for
+the ISR of the pulse engine to keep up with, or that would keep the CPU busy
+servicing interrupts.
+
+TC4 and TC5 are paired into a 32-bit counter, clocked by GCLK1 at 48 MHz, in
+match-frequency mode. The counter overflows at the end of each step, and each
+overflow triggers two DMAC channels to move a single word:
+
+  * Channel 0 writes the toggle mask of the new step to OUTTGL of port PA.
+  * Channel 1 writes the duration of the step after it into the buffered
+    compare register CCBUF0, which the counter loads at its next overflow.
+
+The table gets translated up front into these two word buffers. Each channel
+runs through a pair of linked descriptors A -> B -> A, each covering the whole
+table, so that endless trains keep circling. For a finite number of repeats the
+DMAC interrupt, entered once per pass of the table, unlinks the descriptor of
+the final pass before the DMAC gets to fetch it.
+
+Restrictions:
+  * All outputs must sit on port PA, as only PA gets written.
+  * The table must end with all channels low, i.e. a mask of 0, so that each
+    pass starts from the same output levels.
+  * Steps must last at least `DMA_MIN_TICKS`, and a pass of the table must last
+    at least `DMA_MIN_PASS_TICKS` when the number of repeats is finite.
+  * No `PulseEvent`s get recorded.
+
+Takes DMAC channels 0 and 1, and TC4 and TC5. These are hence off limits for
+other libraries, e.g. Adafruit_ZeroDMA.
+
+Dennis van Gils
+14-10-2026
+------------------------------------------------------------------------------*/
+
+#ifndef DMA_PLAYBACK_H
+#define DMA_PLAYBACK_H
+
+#ifdef _VARIANT_FEATHER_M4_
+
+#include <Arduino.h>
+
+#include "fast_gpio.h"
+#include "pulse_engine.h"
+
+// Limits on the step duration and on the duration of a pass of the table
+#define DMA_MIN_TICKS TICKS_PER_USEC
+#define DMA_MIN_PASS_TICKS (100 * TICKS_PER_USEC)
+
+// Translate the table `steps` of `n_steps` long into the DMA buffers. Returns
+// false when the table does not meet the restrictions listed above.
+//   level_ports: The outputs belonging to each possible bit mask of channels
+//   repeats    : Times to play the table, 0 for endless
+bool dma_playback_load(const SequenceStep *steps, uint16_t n_steps,
+                       const PortMask *level_ports, uint32_t repeats);
+
+// Start playing back the loaded table, with the first step taking place
+// `lead` ticks after the call
+void dma_playback_start(uint32_t lead);
+
+// Stop playing back immediately. Leaves the outputs as they are.
+void dma_playback_stop();
+
+// Is the table being played back? Will turn false by itself once all repeats
+// have been played.
+bool dma_playback_running();
+
+#endif
+#endif
@@ -0,0 +1,64 @@
+/*------------------------------------------------------------------------------
+Idle sleep
+
+Halts the CPU until the next interrupt, instead of letting `loop()` spin at
+full speed, which saves power on battery-powered rigs. Only the CPU clock gets
+stopped. The pulse timer, the DMAC and the serial port keep running, so that:
+
+  * The pulse engine keeps generating its edges from its timer interrupt,
+    which wakes up the CPU. The compare channel fires `SPIN_TICKS` ahead of
+    each edge, sized per board to cover the wake-up, the ISR entry and
+    reading the time, so the edge timing is unchanged.
+  * Incoming serial data wakes up the CPU through the USB (Feather M4) or
+    UART RX (Uno) interrupt.
+  * The millisecond tick of the Arduino core, SysTick (Feather M4) or Timer0
+    (Uno), wakes up the CPU at least once per msec, bounding the delay of
+    anything the main loop polls for.
+
+The deeper STANDBY (Feather M4) and power-down (Uno) modes would stop the
+clock of the pulse timer, and with it the timeline, and are hence not used.
+
+  * Adafruit Feather M4 Express:
+    IDLE sleep mode of the SAMD51 by the `WFI` instruction. Clocks on the bus
+    get gated off until a peripheral requests them.
+  * Arduino Uno:
+    Idle mode of the ATmega328P by the `SLEEP` instruction.
+
+Dennis van Gils
+14-10-2026
+------------------------------------------------------------------------------*/
+
+#ifndef IDLE_SLEEP_H
+#define IDLE_SLEEP_H
+
+#include <Arduino.h>
+
+#ifndef _VARIANT_FEATHER_M4_
+#include <avr/sleep.h>
+#endif
+
+// Sleep until the next interrupt, and enable the interrupts again. Must be
+// called with the interrupts disabled by `noInterrupts()`, from before the
+// check that there is nothing left to do. An interrupt that comes in after that
+// check stays pending and wakes up the CPU straight away, instead of being
+// serviced before the sleep and leaving its work to wait for the next tick.
+static inline void idle_sleep() {
+#ifdef _VARIANT_FEATHER_M4_
+  if (PM->SLEEPCFG.bit.SLEEPMODE != PM_SLEEPCFG_SLEEPMODE_IDLE_Val) {
+    PM->SLEEPCFG.reg = PM_SLEEPCFG_SLEEPMODE_IDLE;
+    while (PM->SLEEPCFG.bit.SLEEPMODE != PM_SLEEPCFG_SLEEPMODE_IDLE_Val) {}
+  }
+  SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+  __DSB();
+  __WFI();        // Wakes up on a pending interrupt, even when masked
+  __enable_irq(); // Only now gets it serviced
+#else
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+  sei(); // Takes effect after the next instruction, so nothing comes in between
+  sleep_cpu();
+  sleep_disable();
+#endif
+}
+
+#endif
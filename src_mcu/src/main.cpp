@@ -6,21 +6,29 @@ A configurable TTL pulse train generator on digital outputs D05 and D06. Can be
 used to e.g. trigger (Ximea) cameras to acquire pictures in sync with each
 other using the camera's trigger-in port.
 
-    <5ms>
+    < W >
     ┌───┐      ┌───┐      ┌───┐
     │   │      │   │      │   │
     │   │      │   │      │   │
     ┘   └──────┘   └──────┘   └────── --> T_meas
     <    DT    >
 
-  * The pulse period `DT` can be set from 10 msec upwards to hours
-    with a resolution of 1 msec.
+  * The pulse period `DT` can be set from 100 usec (Uno: 500 usec) upwards
+    to 49.7 days with a resolution of 1 usec.
+  * The pulse width `W` can be set from 10 usec (Uno: 50 usec) upwards with a
+    resolution of 1 usec.
   * The duration of the pulse train `T_meas`, i.e. the measurement
     time, can be set up to a maximum of 49.7 days.
   * The RGB LED indicates the status.
       - Blue : Idle
       - Green: Running pulse train
+  * Each of the outputs can be given its own period, phase offset, pulse width
+    and period divider on top of `DT` and `W`.
+  * Alternatively, an arbitrary trigger pattern can be played back from a
+    table of up to 1024 (Uno: 32) sequence steps.
   * The other on-board LED #13 will flash red with each pulse.
+  * The edges are generated by a hardware timer, see `pulse_engine.h`, so they
+    do not suffer from jitter caused by the serial communication.
 
 ### Hardware
   Either:
@@ -40,117 +48,1171 @@ Dennis van Gils
 #include <Arduino.h>
 
 #include "DvG_SerialCommand.h"
+#include "idle_sleep.h"
+#include "pulse_engine.h"
+#include "serial_out.h"
+#include "settings_store.h"
+#include "telemetry.h"
 
 #ifdef _VARIANT_FEATHER_M4_
 #include "Adafruit_NeoPixel.h"
+#else
+#include <EEPROM.h>
 #endif
 
-#define PIN_CAM_1 5
-#define PIN_CAM_2 6
-#define PULSE_WIDTH 5 // [msec]
+// Baud rate of the serial port. Can be changed at runtime by the `BAUD...`
+// command, which gets stored in EEPROM. Does not apply to the Feather M4, as it
+// communicates over native USB at full USB speed regardless of the baud rate.
+#ifndef SERIAL_BAUD
+#define SERIAL_BAUD 9600
+#endif
+
+// Limits of the pulse period and width, set by how fast the pulse engine can
+// service the edges
+#ifdef _VARIANT_FEATHER_M4_
+constexpr uint32_t DT_MIN = 100; // [usec]
+constexpr uint32_t W_MIN = 10;   // [usec]
+#else
+constexpr uint32_t DT_MIN = 500; // [usec]
+constexpr uint32_t W_MIN = 50;   // [usec]
+#endif
+
+// Limits when played by the hardware PWM, see `pwm_output.h`, set by the
+// resolution of the settings in usec (Feather M4), or by the overflow interrupt
+// counting the pulses (Uno)
+#ifdef _VARIANT_FEATHER_M4_
+constexpr uint32_t DT_MIN_PWM = 2; // [usec]
+#else
+constexpr uint32_t DT_MIN_PWM = 20; // [usec]
+#endif
+constexpr uint32_t W_MIN_PWM = 1; // [usec]
+
+bool f_pwm = false; // Play plain pulse trains by the hardware PWM?
+
+inline uint32_t dt_min() { return f_pwm ? DT_MIN_PWM : DT_MIN; }
+inline uint32_t w_min() { return f_pwm ? W_MIN_PWM : W_MIN; }
+
+// Longest pulse period [usec], i.e. 49.7 days: The range `DT` had when it was
+// set in msec. Even divided by `DIV` 65535 it fits the 64-bit ticks.
+constexpr uint64_t DT_MAX = (uint64_t)UINT32_MAX * 1000;
+
+uint64_t DT = 1000000; // Pulse period [usec]
+uint64_t W = 5000;     // Pulse width [usec]
+
+// Timing settings per output channel, on top of the global `DT` and `W`
+struct ChannelSettings {
+  uint64_t DT;     // Pulse period [usec], 0 to follow the global `DT`
+  uint32_t offset; // Phase offset of the first rising edge [usec]
+  uint64_t W;      // Pulse width [usec], 0 to follow the global `W`
+  uint16_t div;    // Period divider: Fire every `div`-th period, 0 is off
+};
+
+ChannelSettings channels[N_CHANNELS];
+
+// Table of the pulse sequence, played back instead of the periodic channels
+// depending on `sequence_mode`
+SequenceStep sequence[SEQUENCE_LEN];
+uint16_t sequence_len = 0;     // Number of steps in the table
+uint32_t sequence_repeats = 0; // Times to play the table, 0 for endless
+uint16_t upload_len = 0;       // Bytes of `SQU<n>` awaiting the handshake
 
-uint32_t now = 0;   // [msec] Will keep track of Arduino time
-uint32_t DT = 1000; // [msec]
+enum SequenceMode : uint8_t {
+  SEQUENCE_OFF, // Play the periodic channels
+  SEQUENCE_ISR, // Play the sequence from the ISR of the pulse engine
+  SEQUENCE_DMA, // Play the sequence by DMA (Feather M4 only)
+};
+SequenceMode sequence_mode = SEQUENCE_OFF;
 
 #ifdef _VARIANT_FEATHER_M4_
 uint32_t T_meas = 8 * 3600 * 1000; // [msec]
 #endif
 
-bool f_running = false; // Is pulse train running?
-uint32_t t_start = 0;   // Starting time of the pulse train [msec]
-uint32_t pulse_idx = 0; // Pulse counter
-bool f_HI = false;      // Is the pulse currently in the high state?
-uint32_t t_HI = 0;      // Starting time of the high state [msec]
+bool f_running = false;          // Is pulse train running?
+bool f_stopping = false;         // Reporting the last pulses of a stopped one?
+bool f_autostart = false;        // Start the pulse train on power-up?
+uint32_t dropped_reported = 0;   // Number of dropped pulse events reported
+bool f_binary = false;           // Report pulses as binary records, not text?
+uint8_t telemetry_seq = 0;       // Sequence number of the binary records
+uint32_t loop_max = 0;           // Longest iteration of `loop()` [usec]
 
 // Character buffer for formatted time string
-const uint8_t BUFLEN_TIME = 21;
+constexpr uint8_t BUFLEN_TIME = 24;
 char buf_time[BUFLEN_TIME] = "";
 
 // Character buffer for global messages
-const uint8_t BUFLEN = 64;
+constexpr uint8_t BUFLEN = 64;
 char buf[BUFLEN] = "";
 
+// Serial output of the pulse events gets batched into packets of this size,
+// being the maximum packet size of the native USB of the Feather M4
+constexpr uint8_t TX_PACKET_LEN = OUT_PACKET_LEN;
+static_assert(TELEMETRY_RECORD_LEN <= OUT_RECORD_LEN,
+              "The acknowledgements must fit the record queue of `out`");
+
+// Longest possible text line of a pulse event, including CR LF and '\0'
+constexpr uint8_t LINE_LEN = 50;
+
+#ifndef _VARIANT_FEATHER_M4_
+// The baud rate is stored in EEPROM, preceded by a magic number to recognize
+// that it got written by us
+#define EEPROM_ADDR_BAUD 0
+constexpr uint16_t EEPROM_MAGIC = 0x7B0D;
+
+struct StoredBaud {
+  uint16_t magic;
+  uint32_t baud;
+};
+#endif
+
+uint32_t baud = SERIAL_BAUD;
+#ifndef _VARIANT_FEATHER_M4_
+bool f_baud_pending = false; // Switch to `baud` once the reply went out?
+#endif
+
+// Period of the reference on the sync input during calibration [usec]
+constexpr uint32_t CAL_PERIOD_MAX = 10000000;
+uint32_t cal_period = 0;
+
 // Neopixel
 #ifdef _VARIANT_FEATHER_M4_
 #define NEO_BRIGHTNESS 3 // Brightness level [0 - 255]
 Adafruit_NeoPixel neo(1, PIN_NEOPIXEL, NEO_GRB + NEO_KHZ800);
+
+// `neo.show()` disables interrupts for the whole bitstream, about 30 usec for
+// a single pixel, which would delay any edge falling within. Hence, a new
+// color only gets shown once no edge is due within this many ticks.
+#define NEO_QUIET_TICKS (50 * TICKS_PER_USEC)
+bool neo_pending = false; // Is there a new color waiting to be shown?
+#endif
+
+#ifdef _VARIANT_FEATHER_M4_
+// Set the color of the RGB LED, to be shown by `update_neopixel()`
+void set_neopixel(uint32_t color) {
+  neo.setPixelColor(0, color);
+  neo_pending = true;
+}
+
+// Show the pending color, but only when it can be done without waiting for the
+// latch time of the previous one and without delaying any edge
+void update_neopixel() {
+  if (neo_pending && neo.canShow() && engine_quiet_for(NEO_QUIET_TICKS)) {
+    neo.show();
+    neo_pending = false;
+  }
+}
 #endif
 
 // Instantiate serial command listener
 #define Ser Serial
 DvG_SerialCommand sc(Ser);
 
+// All text output goes through here, see `serial_out.h`
+SerialOut out(Ser);
+
 /*------------------------------------------------------------------------------
   functions
 ------------------------------------------------------------------------------*/
 
-void format_msecs(uint32_t all_msecs) {
-  uint32_t all_secs = all_msecs / 1000;
+// Parse the decimal number at `str`, saturating at `UINT64_MAX`, as the C
+// library of the Uno has no `strtoull()`
+uint64_t parse_u64(const char *str) {
+  uint64_t value = 0;
+
+  for (; (*str >= '0') && (*str <= '9'); str++) {
+    uint8_t digit = *str - '0';
+
+    if (value > (UINT64_MAX - digit) / 10) {
+      return UINT64_MAX;
+    }
+    value = value * 10 + digit;
+  }
+
+  return value;
+}
+
+void format_usecs(uint64_t all_usecs) {
+  uint32_t all_secs = all_usecs / 1000000;
   uint32_t rem_secs = all_secs % 3600;
   uint16_t h = all_secs / 3600;
   uint16_t m = rem_secs / 60;
   uint16_t s = rem_secs % 60;
-  uint16_t u = all_msecs % 1000;
+  uint32_t u = all_usecs % 1000000;
 
-  snprintf(buf_time, BUFLEN_TIME, "%02d:%02d:%02d.%03d", h, m, s, u);
+  snprintf_P(buf_time, BUFLEN_TIME, PSTR("%02u:%02u:%02u.%06lu"), h, m, s,
+             (unsigned long)u);
 }
 
-void go_HI() {
-  static const uint8_t BUF_LEN = 64;
-  static char buf[BUF_LEN] = "";
+// Format a latency [ticks] as usecs with 3 decimals into `buf_time`
+void format_latency(uint32_t ticks) {
+  snprintf_P(buf_time, BUFLEN_TIME, PSTR("%lu.%03lu"),
+             (unsigned long)(ticks / TICKS_PER_USEC),
+             (unsigned long)((ticks % TICKS_PER_USEC) * 1000 / TICKS_PER_USEC));
+}
 
-  f_HI = true;
-  pulse_idx += 1;
-  digitalWrite(PIN_CAM_1, HIGH);
-  digitalWrite(PIN_CAM_2, HIGH);
-  digitalWrite(LED_BUILTIN, HIGH);
+// Print part `part` of the exposure latency report. Returns false once there
+// are no more parts, see `stream_reply()`.
+bool print_latency(uint8_t part) {
+  LatencyStats stats;
+
+  engine_latency_stats(stats);
+  if (part == 0) {
+    out.print(F("  Exposure input = "));
+    out.println(engine_capturing() ? "on" : "off");
+    out.print(F("  Matched   = "));
+    out.println(stats.n);
+
+  } else if (part == 1) {
+    if (stats.n) {
+      format_latency(stats.min);
+      out.print(F("  Min       = "));
+      out.print(buf_time);
+      out.println(F(" usec"));
+      format_latency(stats.max);
+      out.print(F("  Max       = "));
+      out.print(buf_time);
+      out.println(F(" usec"));
+      format_latency(stats.sum / stats.n);
+      out.print(F("  Mean      = "));
+      out.print(buf_time);
+      out.println(F(" usec"));
+    }
 
-  format_msecs(now - t_start);
-  snprintf(buf, BUF_LEN, "# %ld @ t = %s", pulse_idx, buf_time);
-  Ser.println(buf);
+  } else {
+    out.print(F("  Missed    = "));
+    out.println(stats.missed);
+    out.print(F("  Unmatched = "));
+    out.println(stats.unmatched);
+    return false;
+  }
+
+  return true;
 }
 
-void go_LO() {
-  f_HI = false;
-  digitalWrite(PIN_CAM_1, LOW);
-  digitalWrite(PIN_CAM_2, LOW);
-  digitalWrite(LED_BUILTIN, LOW);
+void print_overrun() {
+  const OverrunMode mode = engine_overrun();
+
+  out.print(F("  Overrun   = "));
+  out.println(mode == OVERRUN_ABORT  ? "abort"
+              : mode == OVERRUN_SKIP ? "skip"
+                                     : "burst");
 }
 
-void start_train() {
-  Ser.println("Pulse train started.");
-  now = millis();
-  t_start = t_HI = now;
-  pulse_idx = 0;
-  go_HI();
+// Print part `part` of the timing health since power-up. Returns false once
+// there are no more parts, see `stream_reply()`.
+bool print_stats(uint8_t part) {
+  HealthStats health;
+
+  engine_health(health);
+  if (part == 0) {
+    print_overrun();
+    out.print(F("  Pulses    = "));
+    out.println(health.pulses);
+    format_latency(health.late_max);
+    out.print(F("  Late max  = "));
+    out.print(buf_time);
+    out.println(F(" usec"));
+
+  } else if (part == 1) {
+    format_latency(LATE_TICKS);
+    out.print(F("  Late > "));
+    out.print(buf_time);
+    out.print(F(" usec = "));
+    out.println(health.late_n);
+    out.print(F("  Overruns  = "));
+    out.println(health.overruns);
+    out.print(F("  Skipped   = "));
+    out.println(health.skipped);
+
+  } else if (part == 2) {
+    out.print(F("  Dropped   = "));
+    out.println(health.dropped);
+    out.print(F("  Loop max  = "));
+    out.print(loop_max);
+    out.println(F(" usec"));
+
+  } else {
+    out.print(F("  Out lost  = "));
+    out.println(out.getDropped());
+    out.print(F("  Cut off   = "));
+    out.println(sc.getOverruns());
+    out.print(F("  Frame err = "));
+    out.println(sc.getFrameErrors());
+    return false;
+  }
+
+  return true;
+}
+
+// Make sure the pulse width leaves room for the low state of the pulse
+void constrain_W() {
+  W = constrain(W, (uint64_t)w_min(), DT - w_min());
+}
+
+// Translate the settings of channel `idx` into the timing of the pulse engine
+void get_channel_timing(uint8_t idx, ChannelTiming &timing) {
+  ChannelSettings &ch = channels[idx];
+  uint64_t period = (ch.DT ? ch.DT : DT) * ch.div; // [usec]
+  uint64_t width = ch.W ? ch.W : W;                 // [usec]
+
+  if (period && (width > period - w_min())) {
+    width = period - w_min();
+  }
+
+  timing.period = period * TICKS_PER_USEC;
+  timing.offset = (uint64_t)ch.offset * TICKS_PER_USEC;
+  timing.width = width * TICKS_PER_USEC;
+}
+
+// Hand the changed settings to the running pulse train, which takes them over
+// at the end of the current period of each channel
+void update_train() {
+  ChannelTiming timing[N_CHANNELS];
+
+  if (!f_running || (sequence_mode != SEQUENCE_OFF)) {
+    return;
+  }
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    get_channel_timing(i, timing[i]);
+  }
+  engine_update(timing);
+}
+
+void print_channel(uint8_t idx) {
+  ChannelSettings &ch = channels[idx];
+
+  out.print(F("  C"));
+  out.print(idx + 1);
+  out.print(F(": DT = "));
+  if (ch.DT) {
+    format_usecs(ch.DT);
+    out.print(buf_time);
+  } else {
+    out.print(F("global"));
+  }
+  out.print(F(", PH = "));
+  format_usecs(ch.offset);
+  out.print(buf_time);
+  out.print(F(", W = "));
+  if (ch.W) {
+    format_usecs(ch.W);
+    out.print(buf_time);
+  } else {
+    out.print(F("global"));
+  }
+  out.print(F(", DIV = "));
+  out.println(ch.div);
+}
+
+// Keep the settings of a channel within the limits of the pulse engine
+void constrain_channel(ChannelSettings &ch) {
+  if (ch.DT) {
+    ch.DT = constrain(ch.DT, (uint64_t)dt_min(), DT_MAX);
+  }
+  if (ch.W) {
+    ch.W = constrain(ch.W, (uint64_t)w_min(), DT_MAX);
+  }
+}
+
+// Handle the channel commands of the form `C<n>:<setting><value>`
+void process_channel_command(char *strCmd) {
+  uint8_t idx = strCmd[1] - '1';
+  char *strSub = &strCmd[3];
+
+  if (idx >= N_CHANNELS) {
+    out.println(F("  Invalid channel"));
+    return;
+  }
+  ChannelSettings &ch = channels[idx];
+
+  if ((strncmp(strSub, "DT", 2) == 0) || (strncmp(strSub, "dt", 2) == 0)) {
+    ch.DT = parse_u64(&strSub[2]);
+
+  } else if ((strncmp(strSub, "DIV", 3) == 0) ||
+             (strncmp(strSub, "div", 3) == 0)) {
+    uint32_t div = strtoul(&strSub[3], NULL, 10);
+    ch.div = (div > UINT16_MAX) ? UINT16_MAX : div;
+
+  } else if ((strncmp(strSub, "PH", 2) == 0) ||
+             (strncmp(strSub, "ph", 2) == 0)) {
+    ch.offset = strtoul(&strSub[2], NULL, 10);
+
+  } else if ((strncmp(strSub, "W", 1) == 0) ||
+             (strncmp(strSub, "w", 1) == 0)) {
+    ch.W = parse_u64(&strSub[1]);
+  }
+
+  constrain_channel(ch);
+  update_train();
+  print_channel(idx);
+}
+
+// Add a pulse event to the transmit packet, either as a text line or as a
+// binary record. Returns the number of bytes added.
+uint8_t pack_event(uint8_t *dest, TelemetryType type, uint8_t outputs,
+                   uint32_t pulse_idx, uint64_t t) {
+  if (f_binary) {
+    telemetry_pack(dest, type, outputs, telemetry_seq++, pulse_idx, t);
+    return TELEMETRY_RECORD_LEN;
+  }
+
+  if (type == TELEMETRY_DROPPED) {
+    return snprintf_P((char *)dest, LINE_LEN,
+                      PSTR("! Dropped %lu pulse events\r\n"),
+                      (unsigned long)pulse_idx);
+  }
+
+  if (type == TELEMETRY_LATENCY) {
+    format_latency((uint32_t)t);
+    return snprintf_P((char *)dest, LINE_LEN, PSTR("L %lu : %s usec\r\n"),
+                      (unsigned long)pulse_idx, buf_time);
+  }
+
+  // When not all channels fire together, append which ones do, e.g. " C13"
+  char strChannels[N_CHANNELS + 3] = "";
+  if (outputs != (1 << N_CHANNELS) - 1) {
+    uint8_t j = 0;
+    strChannels[j++] = ' ';
+    strChannels[j++] = 'C';
+    for (uint8_t i = 0; i < N_CHANNELS; i++) {
+      if (outputs & (1 << i)) {
+        strChannels[j++] = '1' + i;
+      }
+    }
+    strChannels[j] = '\0';
+  }
+
+  format_usecs(t / TICKS_PER_USEC);
+  return snprintf_P((char *)dest, LINE_LEN, PSTR("# %lu @ t = %s%s\r\n"),
+                    (unsigned long)pulse_idx, buf_time, strChannels);
+}
+
+// Report the recorded pulse events. Only as many as fit in the serial transmit
+// buffer, so that we never block. The events get batched into packets of up to
+// `TX_PACKET_LEN` bytes, as many whole lines or records as fit, so that the
+// native USB of the Feather M4 has to send as few packets as possible. They
+// bypass the text output `out`, taking priority over it, so the caller should
+// make sure that `out.atLineStart()`.
+void report_pulses() {
+  static uint8_t packet[TX_PACKET_LEN];
+  uint8_t line[LINE_LEN]; // The event being packed
+  uint8_t n = 0;          // Number of bytes in `packet`
+  uint8_t len;            // Number of bytes in `line`
+  uint8_t len_max = f_binary ? TELEMETRY_RECORD_LEN : LINE_LEN;
+  int room = Ser.availableForWrite(); // Free space in the transmit buffer
+  uint32_t dropped;
+  PulseEvent ev;
+  ExposureEvent ex;
+
+  while (room >= n + len_max) {
+    dropped = engine_dropped_events();
+    if (engine_pop_event(ev)) {
+      len = pack_event(line, TELEMETRY_PULSE, ev.outputs, ev.pulse_idx, ev.t);
+    } else if (engine_pop_exposure(ex)) {
+      len = pack_event(line, TELEMETRY_LATENCY, 0, ex.pulse_idx, ex.latency);
+    } else if (dropped != dropped_reported) {
+      len = pack_event(line, TELEMETRY_DROPPED, 0, dropped - dropped_reported,
+                       0);
+      dropped_reported = dropped;
+    } else {
+      break;
+    }
+
+    if (n + len > TX_PACKET_LEN) {
+      Ser.write(packet, n);
+      room -= n;
+      n = 0;
+    }
+    memcpy(&packet[n], line, len);
+    n += len;
+  }
+
+  if (n) {
+    Ser.write(packet, n);
+  }
+}
+
+void print_sequence() {
+  out.print(F("  SQ     = "));
+  out.print(sequence_mode == SEQUENCE_DMA   ? "DMA"
+            : sequence_mode == SEQUENCE_ISR ? "ISR"
+                                            : "off");
+  out.print(F(", "));
+  out.print(sequence_len);
+  out.print(F(" steps, repeats = "));
+  out.println(sequence_repeats);
+}
+
+// Append a step to the sequence table. Returns false when it is full.
+bool append_step(uint32_t delta, uint8_t mask) {
+  if (sequence_len >= SEQUENCE_LEN) {
+    return false;
+  }
+  if (delta < W_MIN * TICKS_PER_USEC) {
+    delta = W_MIN * TICKS_PER_USEC;
+  }
+  sequence[sequence_len].delta = delta;
+  sequence[sequence_len].mask = mask;
+  sequence_len++;
+
+  return true;
+}
+
+// Handle the sequence commands of the form `SQ<subcommand>`
+void process_sequence_command(char *strCmd) {
+  char *strSub = &strCmd[2];
+
+  if (f_running) {
+    out.println(F("  Pulse train is running"));
+    return;
+  }
+
+  if ((*strSub == 'C') || (*strSub == 'c')) {
+    sequence_len = 0;
+
+  } else if ((*strSub == 'A') || (*strSub == 'a')) {
+    // `SQA<delta>,<mask>`: The mask may also be given in hex, e.g. 0x3
+    char *strMask;
+    uint32_t delta = strtoul(&strSub[1], &strMask, 10); // [usec]
+
+    if (*strMask != ',') {
+      out.println(F("  Expected SQA<usecs>,<mask>"));
+      return;
+    }
+    delta = constrain(delta, W_MIN, UINT32_MAX / TICKS_PER_USEC);
+    if (!append_step(delta * TICKS_PER_USEC, strtoul(&strMask[1], NULL, 0))) {
+      out.println(F("  Sequence table is full"));
+      return;
+    }
+
+  } else if ((*strSub == 'U') || (*strSub == 'u')) {
+    // `SQU<n>`: Stream n steps straight into the table, see `finish_upload()`
+    uint32_t n = strtoul(&strSub[1], NULL, 10);
+
+    if ((n == 0) || (n > SEQUENCE_LEN)) {
+      out.println(F("  Expected SQU<steps>, at most the table length"));
+      return;
+    }
+    sequence_len = 0;
+    upload_len = n * sizeof(SequenceStep); // See `begin_upload()`
+    return;
+
+  } else if ((*strSub == 'R') || (*strSub == 'r')) {
+    sequence_repeats = strtoul(&strSub[1], NULL, 10);
+
+  } else if (*strSub == '0') {
+    sequence_mode = SEQUENCE_OFF;
+
+  } else if (*strSub == '1') {
+    sequence_mode = SEQUENCE_ISR;
 
 #ifdef _VARIANT_FEATHER_M4_
-  neo.setPixelColor(0, neo.Color(0, 255, 0)); // Green: running
-  neo.show();
+  } else if (*strSub == '2') {
+    sequence_mode = SEQUENCE_DMA;
 #endif
+
+  } else if (*strSub == '?') {
+    for (uint16_t i = 0; i < sequence_len; i++) {
+      out.print(F("  "));
+      out.print(i);
+      out.print(F(": "));
+      format_usecs(sequence[i].delta / TICKS_PER_USEC);
+      out.print(buf_time);
+      out.print(F(", mask = 0x"));
+      out.println(sequence[i].mask, HEX);
+    }
+  }
+
+  print_sequence();
+}
+
+// Start the upload of `SQU<n>` once all output before it went out, as the host
+// expects nothing but the upload handshake from then on
+void begin_upload() {
+  if (out.pending() || out.pendingRecords()) {
+    return;
+  }
+  sc.beginUpload((uint8_t *)sequence, upload_len);
+  upload_len = 0;
 }
 
+// Take in the steps streamed by `SQU<n>`, each as a little-endian uint32 delta
+// in ticks followed by the uint8 channel mask
+void finish_upload() {
+  if (!sc.getUpload()) {
+    out.println(F("  Upload failed, sequence cleared"));
+    print_sequence();
+    return;
+  }
+
+  sequence_len = sc.getUploadLen() / sizeof(SequenceStep);
+  for (uint16_t i = 0; i < sequence_len; i++) {
+    if (sequence[i].delta < W_MIN * TICKS_PER_USEC) {
+      sequence[i].delta = W_MIN * TICKS_PER_USEC;
+    }
+  }
+  print_sequence();
+}
+
+void print_sync() {
+  const SyncMode mode = engine_sync();
+
+  out.print(F("  Sync   = "));
+  out.println(mode == SYNC_CALIBRATE ? "calibrate"
+              : mode == SYNC_FOLLOW  ? "follow"
+              : mode == SYNC_START   ? "start"
+                                     : "off");
+}
+
+void print_ppb(int32_t value) {
+  uint32_t mag = (value < 0) ? -value : value;
+
+  snprintf_P(buf, BUFLEN, PSTR("%s%lu.%03lu ppm"), (value < 0) ? "-" : "",
+             (unsigned long)(mag / 1000), (unsigned long)(mag % 1000));
+  out.println(buf);
+}
+
+// Parse a decimal number like "-12.5" into thousandths, limited to +/- `limit`,
+// without resorting to floating-point math. Digits beyond the third decimal get
+// rounded.
+int32_t parse_milli(const char *str, uint32_t limit) {
+  bool f_neg = (*str == '-');
+  uint32_t whole = 0;
+  uint32_t frac = 0;
+  uint32_t mag;
+
+  if ((*str == '-') || (*str == '+')) {
+    str++;
+  }
+  for (; isdigit(*str); str++) {
+    if (whole <= limit / 1000) { // Beyond, it saturates anyway
+      whole = whole * 10 + (*str - '0');
+    }
+  }
+  if (*str == '.') {
+    str++;
+    for (uint16_t scale = 100; scale && isdigit(*str); scale /= 10, str++) {
+      frac += (*str - '0') * scale;
+    }
+    if (*str >= '5' && *str <= '9') {
+      frac++;
+    }
+  }
+
+  mag = (whole > limit / 1000) ? limit : min(whole * 1000 + frac, limit);
+  return f_neg ? -(int32_t)mag : (int32_t)mag;
+}
+
+// Drift of the board oscillator as measured by the calibration so far [ppb].
+// Returns false when there are not yet enough reference edges.
+bool measured_ppb(int32_t &value) {
+  uint64_t span;
+  uint64_t ref = (uint64_t)cal_period * TICKS_PER_USEC;
+  uint64_t n_periods;
+  int64_t err;
+
+  if ((engine_calibration(span) < 2) || (ref == 0)) {
+    return false;
+  }
+  n_periods = (span + ref / 2) / ref;
+  if (n_periods == 0) {
+    return false;
+  }
+  err = (int64_t)(span - n_periods * ref);
+  value = err * 1000000000LL / (int64_t)(n_periods * ref);
+
+  return true;
+}
+
+void print_calibration() {
+  uint64_t span;
+  int32_t value;
+
+  out.print(F("  CAL    = "));
+  out.print(engine_calibration(span));
+  out.print(F(" edges over "));
+  format_usecs(span / TICKS_PER_USEC);
+  out.println(buf_time);
+  out.print(F("  Drift  = "));
+  if (measured_ppb(value)) {
+    print_ppb(value);
+  } else {
+    out.println(F("awaiting reference edges"));
+  }
+}
+
+void print_trigger() {
+  const TriggerMode mode = engine_trigger();
+
+  out.print(F("  Trig   = "));
+  out.println(mode == TRIGGER_GATE   ? "gate"
+              : mode == TRIGGER_EDGE ? "edge"
+                                     : "off");
+}
+
+// Stop the pulse train. The pulses not yet reported still go out from the main
+// loop by `finish_stop()`, without blocking it, followed by the reply.
 void stop_train() {
-  Ser.println("Pulse train stopped.");
-  go_LO();
+  engine_stop();
+  f_stopping = true;
+}
+
+// Report the remaining pulses of the stopped pulse train as far as the port has
+// room, and announce the stop once all of them went out. With `f_discard`, the
+// pulses that do not fit the port right away get discarded instead of waited
+// for. They then get reported as dropped through the text output, ahead of the
+// announcement.
+void finish_stop(bool f_discard) {
+  uint32_t n_discarded;
+  uint8_t line[LINE_LEN];
+  uint8_t len;
+  PulseEvent ev;
+  ExposureEvent ex;
+
+  if (out.atLineStart()) {
+    report_pulses();
+  }
+  if (f_discard) {
+    n_discarded = engine_dropped_events() - dropped_reported;
+    while (engine_pop_event(ev)) {
+      n_discarded++;
+    }
+    while (engine_pop_exposure(ex)) {
+      n_discarded++;
+    }
+    dropped_reported = engine_dropped_events();
+    if (n_discarded) {
+      len = pack_event(line, TELEMETRY_DROPPED, 0, n_discarded, 0);
+      if (f_binary) {
+        out.writeRecord(line, len);
+      } else {
+        out.write(line, len);
+      }
+    }
+  } else if (engine_events_pending() ||
+             (engine_dropped_events() != dropped_reported)) {
+    return;
+  }
+  f_stopping = false;
+
+  if (engine_aborted()) {
+    out.println(F("! Fell behind the schedule, pulse train aborted"));
+  }
+  out.println(F("Pulse train stopped."));
 
 #ifdef _VARIANT_FEATHER_M4_
-  neo.setPixelColor(0, neo.Color(0, 0, 255)); // Blue: idle
-  neo.show();
+  set_neopixel(neo.Color(0, 0, 255)); // Blue: idle
+#endif
+}
+
+// Keep the timing of the channels within the limits of the pulse engine, when
+// the limits of the hardware PWM got applied to the settings
+void clamp_to_isr(ChannelTiming *timing) {
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    ChannelTiming &t = timing[i];
+
+    if (!t.period) {
+      continue;
+    }
+    t.period = max(t.period, (uint64_t)DT_MIN * TICKS_PER_USEC);
+    t.width = constrain(t.width, (uint64_t)W_MIN * TICKS_PER_USEC,
+                        t.period - (uint64_t)W_MIN * TICKS_PER_USEC);
+  }
+}
+
+// Arm the pulse train and fire it, or leave the firing to the sync or trigger
+// input. The reply only gets printed after firing, so that the first edge
+// follows the command by a fixed `START_LEAD` after it got parsed.
+void start_train() {
+  ChannelTiming timing[N_CHANNELS];
+  uint64_t T_meas_ticks = 0;
+  bool f_dma_refused = false; // Sequence did not qualify for DMA playback?
+  bool f_pwm_refused = false; // Channels did not qualify for the PWM?
+
+  if (f_stopping) {
+    // The pulses of the previous train that did not go out yet get discarded
+    // and counted as dropped, as arming resets the event buffers
+    finish_stop(true);
+  }
+
+  dropped_reported = 0;
+#ifdef _VARIANT_FEATHER_M4_
+  T_meas_ticks = (uint64_t)T_meas * TICKS_PER_MSEC;
+#endif
+
+  if (sequence_mode == SEQUENCE_OFF) {
+    for (uint8_t i = 0; i < N_CHANNELS; i++) {
+      get_channel_timing(i, timing[i]);
+    }
+    if (!f_pwm || !engine_arm_pwm(timing, T_meas_ticks)) {
+      f_pwm_refused = f_pwm;
+      if (f_pwm) {
+        clamp_to_isr(timing);
+      }
+      engine_arm(timing, T_meas_ticks);
+    }
+#ifdef _VARIANT_FEATHER_M4_
+  } else if ((sequence_mode == SEQUENCE_DMA) &&
+             engine_arm_sequence_dma(sequence, sequence_len, sequence_repeats,
+                                     T_meas_ticks)) {
+    // Playing back by DMA
+#endif
+  } else {
+    f_dma_refused = (sequence_mode == SEQUENCE_DMA);
+    engine_arm_sequence(sequence, sequence_len, sequence_repeats,
+                        T_meas_ticks);
+  }
+  engine_fire();
+
+  out.println(F("Pulse train started."));
+  if (f_dma_refused) {
+    out.println(F("  Sequence does not qualify for DMA, playing it by ISR"));
+  }
+  if (f_pwm_refused) {
+    out.println(F("  Channels do not qualify for PWM, playing them by ISR"));
+  }
+  if (engine_armed()) {
+    out.println(F("  Armed, awaiting the sync or trigger input"));
+  }
+
+#ifdef _VARIANT_FEATHER_M4_
+  set_neopixel(neo.Color(0, 255, 0)); // Green: running
 #endif
 }
 
+/*------------------------------------------------------------------------------
+  Binary commands
+
+  Framed binary commands, see `DvG_SerialCommand.h` for the framing, as a
+  compact alternative to the text commands for a host program. The payload of
+  a frame consists of the command id, see `FrameCommandId`, followed by its
+  little-endian arguments. Each frame gets acknowledged by a binary record of
+  type `TELEMETRY_ACK`, see `telemetry.h`, holding the command id and the
+  resulting `FrameStatus`.
+------------------------------------------------------------------------------*/
+
+enum FrameCommandId : uint8_t {
+  FRAME_SET_DT = 0x01,      // uint32 DT [usec], up to 71 min, see `DT...`
+  FRAME_SET_W = 0x02,       // uint32 W [usec]
+  FRAME_SET_CHANNEL = 0x03, // uint8 channel index, uint32 DT [usec],
+                            // uint32 offset [usec], uint32 W [usec],
+                            // uint16 div, as for the `Cn:...` commands
+  FRAME_START = 0x04,       // Start the pulse train, no arguments
+  FRAME_STOP = 0x05,        // Stop the pulse train, no arguments
+  FRAME_SEQ_CLEAR = 0x10,   // Clear the sequence table, no arguments
+  FRAME_SEQ_APPEND = 0x11,  // One or more `SequenceStep`s, 5 bytes each
+  FRAME_SEQ_MODE = 0x12,    // uint8 `SequenceMode`, uint32 repeats
+};
+
+enum FrameStatus : uint8_t {
+  FRAME_OK = 0,
+  FRAME_BAD_LENGTH = 1, // Arguments of the wrong length
+  FRAME_UNKNOWN = 2,    // Unknown command id
+  FRAME_BUSY = 3,       // Not allowed while the pulse train is running
+  FRAME_BAD_VALUE = 4,  // Argument out of range
+  FRAME_FULL = 5,       // Sequence table is full
+};
+
+// Dispatch table entry. A `len` of `FRAME_ANY_LEN` lets the handler check the
+// length of the arguments itself.
+#define FRAME_ANY_LEN 0xFF
+struct FrameCommand {
+  FrameCommandId id;
+  uint8_t len;
+  FrameStatus (*handler)(const uint8_t *args, uint8_t len);
+};
+
+static inline uint16_t get_u16(const uint8_t *p) {
+  return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+}
+
+static inline uint32_t get_u32(const uint8_t *p) {
+  return (uint32_t)get_u16(p) | ((uint32_t)get_u16(&p[2]) << 16);
+}
+
+FrameStatus frame_set_DT(const uint8_t *args, uint8_t len) {
+  DT = constrain((uint64_t)get_u32(args), (uint64_t)dt_min(), DT_MAX);
+  constrain_W();
+  update_train();
+  return FRAME_OK;
+}
+
+FrameStatus frame_set_W(const uint8_t *args, uint8_t len) {
+  W = get_u32(args);
+  constrain_W();
+  update_train();
+  return FRAME_OK;
+}
+
+FrameStatus frame_set_channel(const uint8_t *args, uint8_t len) {
+  if (args[0] >= N_CHANNELS) {
+    return FRAME_BAD_VALUE;
+  }
+  ChannelSettings &ch = channels[args[0]];
+  ch.DT = get_u32(&args[1]);
+  ch.offset = get_u32(&args[5]);
+  ch.W = get_u32(&args[9]);
+  ch.div = get_u16(&args[13]);
+  constrain_channel(ch);
+  update_train();
+  return FRAME_OK;
+}
+
+FrameStatus frame_start(const uint8_t *args, uint8_t len) {
+  if (!f_running) {
+    f_running = true;
+    start_train();
+  }
+  return FRAME_OK;
+}
+
+FrameStatus frame_stop(const uint8_t *args, uint8_t len) {
+  if (f_running) {
+    f_running = false;
+    stop_train();
+  }
+  return FRAME_OK;
+}
+
+FrameStatus frame_seq_clear(const uint8_t *args, uint8_t len) {
+  if (f_running) {
+    return FRAME_BUSY;
+  }
+  sequence_len = 0;
+  return FRAME_OK;
+}
+
+FrameStatus frame_seq_append(const uint8_t *args, uint8_t len) {
+  if (f_running) {
+    return FRAME_BUSY;
+  }
+  if ((len == 0) || (len % sizeof(SequenceStep))) {
+    return FRAME_BAD_LENGTH;
+  }
+  for (; len; len -= sizeof(SequenceStep), args += sizeof(SequenceStep)) {
+    if (!append_step(get_u32(args), args[4])) {
+      return FRAME_FULL;
+    }
+  }
+  return FRAME_OK;
+}
+
+FrameStatus frame_seq_mode(const uint8_t *args, uint8_t len) {
+  if (f_running) {
+    return FRAME_BUSY;
+  }
+#ifdef _VARIANT_FEATHER_M4_
+  if (args[0] > SEQUENCE_DMA) {
+#else
+  if (args[0] > SEQUENCE_ISR) {
+#endif
+    return FRAME_BAD_VALUE;
+  }
+  sequence_mode = (SequenceMode)args[0];
+  sequence_repeats = get_u32(&args[1]);
+  return FRAME_OK;
+}
+
+static const FrameCommand frame_commands[] = {
+    {FRAME_SET_DT, 4, frame_set_DT},
+    {FRAME_SET_W, 4, frame_set_W},
+    {FRAME_SET_CHANNEL, 15, frame_set_channel},
+    {FRAME_START, 0, frame_start},
+    {FRAME_STOP, 0, frame_stop},
+    {FRAME_SEQ_CLEAR, 0, frame_seq_clear},
+    {FRAME_SEQ_APPEND, FRAME_ANY_LEN, frame_seq_append},
+    {FRAME_SEQ_MODE, 5, frame_seq_mode},
+};
+
+// Dispatch the incoming binary frame and acknowledge it
+void process_frame() {
+  uint8_t len;
+  const uint8_t *frame = sc.getFrame(len);
+  FrameStatus status = FRAME_UNKNOWN;
+  uint8_t reply[TELEMETRY_RECORD_LEN];
+
+  for (const FrameCommand &cmd : frame_commands) {
+    if (cmd.id != frame[0]) {
+      continue;
+    }
+    if ((cmd.len != FRAME_ANY_LEN) && (cmd.len != len - 1)) {
+      status = FRAME_BAD_LENGTH;
+    } else {
+      status = cmd.handler(&frame[1], len - 1);
+    }
+    break;
+  }
+
+  telemetry_pack(reply, TELEMETRY_ACK, frame[0], telemetry_seq++, status, 0);
+  out.writeRecord(reply, TELEMETRY_RECORD_LEN);
+}
+
+bool is_valid_baud(uint32_t b) {
+  static const uint32_t valid[] = {9600,   19200,  38400,   57600,
+                                   115200, 230400, 250000,  500000,
+                                   1000000, 2000000};
+
+  for (uint8_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+    if (b == valid[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+#ifndef _VARIANT_FEATHER_M4_
+void load_baud() {
+  StoredBaud stored;
+
+  EEPROM.get(EEPROM_ADDR_BAUD, stored);
+  if ((stored.magic == EEPROM_MAGIC) && is_valid_baud(stored.baud)) {
+    baud = stored.baud;
+  }
+}
+
+void save_baud() {
+  StoredBaud stored = {EEPROM_MAGIC, baud};
+
+  EEPROM.put(EEPROM_ADDR_BAUD, stored); // Only writes the bytes that changed
+}
+
+// Switch the port over to `baud`, but only once the reply to `BAUD...` went out
+// in full at the old baud rate, so that the main loop never waits for it
+void switch_baud() {
+  if (out.pending() || out.pendingRecords() ||
+      (Ser.availableForWrite() < SERIAL_TX_BUFFER_SIZE - 1)) {
+    return;
+  }
+  Ser.flush(); // Merely the last byte still shifting out
+  Ser.end();
+  Ser.begin(baud);
+  f_baud_pending = false;
+}
+#endif
+
+/*------------------------------------------------------------------------------
+  Stored settings
+
+  The `save` command stores all settings in non-volatile memory, see
+  `settings_store.h`, from which they get loaded again on power-up. The baud
+  rate of the Uno gets stored by its own `BAUD...` command instead, as it has to
+  be known before the serial port opens.
+------------------------------------------------------------------------------*/
+
+struct StoredSettings {
+  uint64_t DT;
+  uint64_t W;
+  uint32_t T_meas; // Not used by the Uno
+  ChannelSettings channels[N_CHANNELS];
+  uint32_t sequence_repeats;
+  uint16_t sequence_len;
+  SequenceMode sequence_mode;
+  SyncMode sync_mode;
+  TriggerMode trigger_mode;
+  OverrunMode overrun_mode;
+  bool f_capture;
+  bool f_binary;
+  bool f_autostart;
+  bool f_pwm;
+  int32_t ppb;
+  uint32_t cal_period;
+  SequenceStep sequence[SEQUENCE_LEN];
+};
+
+// The settings get gathered on the stack, only while saving or loading, so that
+// they do not take up SRAM for good
+bool save_settings() {
+  StoredSettings stored;
+
+  stored.DT = DT;
+  stored.W = W;
+#ifdef _VARIANT_FEATHER_M4_
+  stored.T_meas = T_meas;
+#else
+  stored.T_meas = 0;
+#endif
+  memcpy(stored.channels, channels, sizeof(channels));
+  stored.sequence_repeats = sequence_repeats;
+  stored.sequence_len = sequence_len;
+  stored.sequence_mode = sequence_mode;
+  stored.sync_mode = engine_sync();
+  stored.trigger_mode = engine_trigger();
+  stored.overrun_mode = engine_overrun();
+  stored.f_capture = engine_capturing();
+  stored.f_binary = f_binary;
+  stored.f_autostart = f_autostart;
+  stored.f_pwm = f_pwm;
+  stored.ppb = engine_ppb();
+  stored.cal_period = cal_period;
+  memcpy(stored.sequence, sequence, sizeof(sequence));
+
+  return store_save(&stored, sizeof(stored));
+}
+
+// Load the stored settings, if any, keeping them within limits as the layout
+// might be shared by another build
+bool load_settings() {
+  StoredSettings stored;
+
+  if (!store_load(&stored, sizeof(stored))) {
+    return false;
+  }
+
+  f_pwm = stored.f_pwm;
+  DT = constrain(stored.DT, (uint64_t)dt_min(), DT_MAX);
+  W = stored.W;
+  constrain_W();
+#ifdef _VARIANT_FEATHER_M4_
+  T_meas = constrain(stored.T_meas, 10, UINT32_MAX);
+#endif
+  memcpy(channels, stored.channels, sizeof(channels));
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    constrain_channel(channels[i]);
+  }
+
+  memcpy(sequence, stored.sequence, sizeof(sequence));
+  sequence_len = min(stored.sequence_len, SEQUENCE_LEN);
+  sequence_repeats = stored.sequence_repeats;
+#ifdef _VARIANT_FEATHER_M4_
+  sequence_mode = (stored.sequence_mode <= SEQUENCE_DMA) ? stored.sequence_mode
+                                                         : SEQUENCE_OFF;
+#else
+  sequence_mode = (stored.sequence_mode <= SEQUENCE_ISR) ? stored.sequence_mode
+                                                         : SEQUENCE_OFF;
+#endif
+
+  cal_period = min(stored.cal_period, (uint32_t)CAL_PERIOD_MAX);
+  engine_set_sync(stored.sync_mode <= SYNC_CALIBRATE ? stored.sync_mode
+                                                    : SYNC_OFF);
+  engine_set_trigger(stored.trigger_mode <= TRIGGER_GATE ? stored.trigger_mode
+                                                         : TRIGGER_OFF);
+  engine_set_overrun(stored.overrun_mode <= OVERRUN_ABORT ? stored.overrun_mode
+                                                          : OVERRUN_BURST);
+  engine_set_ppb(constrain(stored.ppb, -PPB_MAX, PPB_MAX));
+  engine_capture(stored.f_capture);
+  f_binary = stored.f_binary;
+  f_autostart = stored.f_autostart;
+
+  return true;
+}
+
 /*------------------------------------------------------------------------------
   setup
 ------------------------------------------------------------------------------*/
 
 void setup() {
-  Ser.begin(9600);
+#ifndef _VARIANT_FEATHER_M4_
+  load_baud();
+#endif
+  Ser.begin(baud);
 
-  pinMode(PIN_CAM_1, OUTPUT);
-  pinMode(PIN_CAM_2, OUTPUT);
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    pinMode(channel_pins[i], OUTPUT);
+    channels[i] = {0, 0, 0, 1};
+  }
   pinMode(LED_BUILTIN, OUTPUT);
-  go_LO();
+  pinMode(PIN_SYNC_OUT, OUTPUT);
+  engine_begin();
+  engine_stop();
 
 #ifdef _VARIANT_FEATHER_M4_
   neo.begin();
@@ -158,6 +1220,240 @@ void setup() {
   neo.setBrightness(NEO_BRIGHTNESS);
   neo.show();
 #endif
+
+  if (load_settings() && f_autostart) {
+    f_running = true;
+    start_train();
+  }
+}
+
+/*------------------------------------------------------------------------------
+  Help
+
+  The help text lives in flash and gets streamed out by `stream_help()` from
+  the main loop, as far as the text output has room, so that it neither takes
+  up SRAM nor blocks the loop for hundreds of msecs at 9600 baud.
+------------------------------------------------------------------------------*/
+
+// clang-format off
+const char help_text[] PROGMEM =
+    "-------------------------------------------------------------------\r\n"
+    "  Arduino trigger box\r\n"
+    "  https://github.com/Dennis-van-Gils/project-Arduino-trigger-box\r\n"
+    "\r\n"
+    "  A configurable TTL pulse train generator on digital outputs\r\n"
+    "  D05 and D06. Can be used to e.g. trigger (Ximea) cameras to\r\n"
+    "  acquire pictures in sync with each other using the camera's\r\n"
+    "  trigger-in port.\r\n"
+    "-------------------------------------------------------------------\r\n"
+    "\r\n"
+    "  < W >\r\n"
+    "  ┌───┐      ┌───┐      ┌───┐\r\n"
+    "  │   │      │   │      │   │\r\n"
+    "  │   │      │   │      │   │\r\n"
+    "  ┘   └──────┘   └──────┘   └────── --> T_meas\r\n"
+    "  <    DT    >\r\n"
+    "\r\n"
+#ifdef _VARIANT_FEATHER_M4_
+    "  * The pulse period `DT` can be set from 100 usec upwards to\r\n"
+    "    49.7 days with a resolution of 1 usec.\r\n"
+    "\r\n"
+    "  * The pulse width `W` can be set from 10 usec upwards with a\r\n"
+    "    resolution of 1 usec.\r\n"
+#else
+    "  * The pulse period `DT` can be set from 500 usec upwards to\r\n"
+    "    49.7 days with a resolution of 1 usec.\r\n"
+    "\r\n"
+    "  * The pulse width `W` can be set from 50 usec upwards with a\r\n"
+    "    resolution of 1 usec.\r\n"
+#endif
+#ifdef _VARIANT_FEATHER_M4_
+    "\r\n"
+    "  * The duration of the pulse train `T_meas`, i.e. the measurement\r\n"
+    "    time, can be set up to a maximum of 49.7 days.\r\n"
+    "\r\n"
+    "  * The RGB LED indicates the status.\r\n"
+    "    Blue : Idle\r\n"
+    "    Green: Running pulse train\r\n"
+#endif
+    "\r\n"
+    "  * The onboard LED (#13) will flash red with each pulse.\r\n"
+    "\r\n"
+    "Commands:\r\n"
+    "  ?     : Show current settings\r\n"
+    "  stats : Show the timing health since power-up\r\n"
+    "  save / load : Store all settings / load the stored ones\r\n"
+    "  AUTO1 / AUTO0 : Do / do not start the pulse train on power-up,\r\n"
+    "          once saved\r\n"
+    "  PWM1 / PWM0 : Do / do not play plain pulse trains by the hardware\r\n"
+#ifdef _VARIANT_FEATHER_M4_
+    "          PWM, down to DT2 and W1\r\n"
+#else
+    "          PWM, down to DT20 and W1\r\n"
+#endif
+    "  DT... : Set the pulse interval `DT` to ... usecs\r\n"
+    "  W...  : Set the pulse width `W` to ... usecs\r\n"
+    "  Cn:DT...  : Set the period of channel n to ... usecs, 0 is `DT`\r\n"
+    "  Cn:PH...  : Delay the first pulse of channel n by ... usecs\r\n"
+    "  Cn:W...   : Set the pulse width of channel n to ... usecs, 0 is `W`\r\n"
+    "  Cn:DIV... : Fire channel n only every ...-th period, 0 is off\r\n"
+    "  SQC   : Clear the pulse sequence\r\n"
+    "  SQA...,m  : Append a sequence step: Channels in bit mask m high,\r\n"
+    "              next step ... usecs later\r\n"
+    "  SQU...: Upload ... binary sequence steps, replacing the table\r\n"
+    "  SQR...: Play the sequence ... times, 0 is endless\r\n"
+    "  SQ1 / SQ0 : Play the sequence / the channels on start\r\n"
+#ifdef _VARIANT_FEATHER_M4_
+    "  SQ2   : Play the sequence by DMA on start, without reports\r\n"
+#endif
+    "  SQ?   : List the sequence\r\n"
+#ifdef _VARIANT_FEATHER_M4_
+    "  T...  : Set the measurement time `T_meas` to ... msecs\r\n"
+#endif
+#ifdef _VARIANT_FEATHER_M4_
+    "  L1 / L0 : Enable / disable the exposure input on pin A2\r\n"
+#else
+    "  L1 / L0 : Enable / disable the exposure input on pin D08\r\n"
+#endif
+    "  L     : Show the trigger-to-exposure latency statistics\r\n"
+#ifdef _VARIANT_FEATHER_M4_
+    "  SY0 / SY1 / SY2 : Ignore the sync input on pin A3 / start on\r\n"
+#else
+    "  SY0 / SY1 / SY2 : Ignore the sync input on pin D02 / start on\r\n"
+#endif
+    "          its edge / start on it and follow its later edges\r\n"
+#ifdef _VARIANT_FEATHER_M4_
+    "  TRIG0 / TRIG1 / TRIG2 : Ignore the trigger input on pin A4 /\r\n"
+#else
+    "  TRIG0 / TRIG1 / TRIG2 : Ignore the trigger input on pin D03 /\r\n"
+#endif
+    "          start on its rising edge / run while it is high\r\n"
+    "  CAL...: Calibrate the drift against a reference of ... usecs period\r\n"
+    "          on the sync input, e.g. CAL1000000 for 1 PPS, 0 to stop\r\n"
+    "  CAL   : Show the calibration so far\r\n"
+    "  CALA  : Apply the calibrated drift correction and stop calibrating\r\n"
+    "  PPM...: Set the drift correction to ... ppm\r\n"
+    "  OV0 / OV1 / OV2 : On falling behind the schedule, fire the missed\r\n"
+    "          pulses in a burst / skip them / abort the pulse train\r\n"
+    "  b     : Toggle pulse reporting between text and binary records\r\n"
+#ifndef _VARIANT_FEATHER_M4_
+    "  BAUD...: Set and store the baud rate, up to 2000000\r\n"
+#endif
+    "  s     : Start / stop\r\n"
+    "\r\n";
+// clang-format on
+
+const char *help_pos = nullptr; // Part of `help_text` still to be sent
+
+// Queue the next chunk of the help text, once the text output has room for it.
+// Stops once the pulse train runs, leaving the pulse reports the bandwidth.
+void stream_help() {
+  uint8_t chunk[32];
+  uint8_t n = 0; // Number of bytes in `chunk`
+  char c;
+
+  if (f_running) {
+    help_pos = nullptr;
+    return;
+  }
+  if (out.availableForWrite() < (int)sizeof(chunk)) {
+    return;
+  }
+
+  while (n < sizeof(chunk)) {
+    c = pgm_read_byte(help_pos);
+    if (c == '\0') {
+      help_pos = nullptr;
+      break;
+    }
+    chunk[n++] = c;
+    help_pos++;
+  }
+
+  if (n) {
+    out.write(chunk, n);
+  }
+}
+
+// Print part `part` of the reply to `?`. Returns false once there are no more
+// parts, see `stream_reply()`.
+bool print_settings(uint8_t part) {
+  enum { PART_TIMING, PART_CHANNELS, PART_MODES = PART_CHANNELS + N_CHANNELS,
+         PART_CLOCK, PART_OUTPUT };
+
+  if (part == PART_TIMING) {
+    out.println(F("Current settings:"));
+    format_usecs(DT);
+    out.print(F("  DT     = "));
+    out.println(buf_time);
+    format_usecs(W);
+    out.print(F("  W      = "));
+    out.println(buf_time);
+#ifdef _VARIANT_FEATHER_M4_
+    format_usecs((uint64_t)T_meas * 1000);
+    out.print(F("  T_meas = "));
+    out.println(buf_time);
+#endif
+
+  } else if (part < PART_MODES) {
+    print_channel(part - PART_CHANNELS);
+
+  } else if (part == PART_MODES) {
+    print_sequence();
+    print_sync();
+    print_trigger();
+
+  } else if (part == PART_CLOCK) {
+    out.print(F("  PPM    = "));
+    print_ppb(engine_ppb());
+    out.print(F("  f_tick = "));
+    out.print(TICKS_PER_USEC * 1000000);
+    out.println(F(" Hz"));
+
+  } else {
+    out.print(F("  Output = "));
+    out.println(f_binary ? "binary" : "text");
+    out.print(F("  Auto   = "));
+    out.println(f_autostart ? "on" : "off");
+    out.print(F("  PWM    = "));
+    out.println(f_pwm ? "on" : "off");
+#ifdef _VARIANT_FEATHER_M4_
+    out.println(F("  Baud   = native USB"));
+#else
+    out.print(F("  Baud   = "));
+    out.println(baud);
+#endif
+    return false;
+  }
+
+  return true;
+}
+
+// The replies of several lines, being longer than the text output of the Uno,
+// get printed in parts of at most `REPLY_PART_LEN` bytes, each once `out` has
+// room for it
+constexpr uint16_t REPLY_PART_LEN = 120;
+static_assert(OUT_BUF_LEN > REPLY_PART_LEN,
+              "Each part of a reply must fit the text output `out`");
+
+bool (*reply)(uint8_t part) = nullptr; // Reply still being printed
+uint8_t reply_part = 0;                // Next part of `reply` to print
+
+// Print the next parts of the reply, as far as the text output has room
+void stream_reply() {
+  while (reply && (out.availableForWrite() > REPLY_PART_LEN)) {
+    if (!reply(reply_part++)) {
+      reply = nullptr;
+    }
+  }
+}
+
+// Print `printer` part by part from the main loop, taking over from any reply
+// still being printed
+void start_reply(bool (*printer)(uint8_t part)) {
+  reply = printer;
+  reply_part = 0;
+  stream_reply();
 }
 
 /*------------------------------------------------------------------------------
@@ -166,38 +1462,215 @@ void setup() {
 
 void loop() {
   char *strCmd; // Incoming serial command string
+  uint32_t t_loop = micros();
 
-  if (sc.available()) {
+  // Poll once per pass: A frame or upload completing while polling again would
+  // otherwise get taken for an empty text command by `getCmd()`, answered by
+  // the help text
+  bool f_received = sc.available();
+
+  if (f_received && sc.isFrame()) {
+    process_frame();
+
+  } else if (f_received && sc.isUpload()) {
+    finish_upload();
+
+  } else if (f_received) {
     strCmd = sc.getCmd();
 
     if (strcmp(strCmd, "?") == 0) {
-      Ser.println("Current settings:");
-      format_msecs(DT);
-      Ser.print("  DT     = ");
-      Ser.println(buf_time);
+      start_reply(print_settings);
+
+    } else if ((strcmp(strCmd, "stats") == 0) ||
+               (strcmp(strCmd, "STATS") == 0)) {
+      start_reply(print_stats);
 
+    } else if ((strcmp(strCmd, "save") == 0) ||
+               (strcmp(strCmd, "SAVE") == 0)) {
+      if (f_running) {
+        out.println(F("  Pulse train is running"));
+      } else if (save_settings()) {
+        out.println(F("  Settings saved"));
+      } else {
+        out.println(F("  Settings do not fit the storage"));
+      }
+
+    } else if ((strcmp(strCmd, "load") == 0) ||
+               (strcmp(strCmd, "LOAD") == 0)) {
+      if (f_running) {
+        out.println(F("  Pulse train is running"));
+      } else if (load_settings()) {
+        out.println(F("  Settings loaded"));
+      } else {
+        out.println(F("  No settings stored"));
+      }
+
+    } else if ((strncmp(strCmd, "AUTO", 4) == 0) ||
+               (strncmp(strCmd, "auto", 4) == 0)) {
+      f_autostart = (strCmd[4] == '1');
+      out.print(F("  Auto   = "));
+      out.println(f_autostart ? "on" : "off");
+
+    } else if ((strncmp(strCmd, "PWM", 3) == 0) ||
+               (strncmp(strCmd, "pwm", 3) == 0)) {
+      if (f_running) {
+        out.println(F("  Pulse train is running"));
+      } else {
+        f_pwm = (strCmd[3] == '1');
+        // Back within the limits of the pulse engine
+        DT = constrain(DT, (uint64_t)dt_min(), DT_MAX);
+        constrain_W();
+        for (uint8_t i = 0; i < N_CHANNELS; i++) {
+          constrain_channel(channels[i]);
+        }
+        out.print(F("  PWM    = "));
+        out.println(f_pwm ? "on" : "off");
+      }
+
+    } else if ((strncmp(strCmd, "BAUD", 4) == 0) ||
+               (strncmp(strCmd, "baud", 4) == 0)) {
 #ifdef _VARIANT_FEATHER_M4_
-      format_msecs(T_meas);
-      Ser.print("  T_meas = ");
-      Ser.println(buf_time);
+      out.println(F("  Baud   = native USB, the baud rate does not apply"));
+#else
+      uint32_t new_baud = strtoul(&strCmd[4], NULL, 10);
+
+      if (f_running || !is_valid_baud(new_baud)) {
+        out.println(F("  Invalid baud rate, or pulse train is running"));
+      } else {
+        baud = new_baud;
+        save_baud();
+        out.print(F("  Baud   = "));
+        out.println(baud);
+        f_baud_pending = true; // See `switch_baud()`
+      }
 #endif
 
+    } else if ((strcmp(strCmd, "L") == 0) || (strcmp(strCmd, "l") == 0)) {
+      start_reply(print_latency);
+
+    } else if ((strcmp(strCmd, "L1") == 0) || (strcmp(strCmd, "l1") == 0)) {
+      if (!engine_capture(true)) {
+        out.println(F("  Not while the PWM plays"));
+      }
+      start_reply(print_latency);
+
+    } else if ((strcmp(strCmd, "L0") == 0) || (strcmp(strCmd, "l0") == 0)) {
+      engine_capture(false);
+      start_reply(print_latency);
+
+    } else if ((strncmp(strCmd, "SY", 2) == 0) ||
+               (strncmp(strCmd, "sy", 2) == 0)) {
+      if (f_running) {
+        out.println(F("  Pulse train is running"));
+      } else if (strCmd[2] == '1') {
+        engine_set_sync(SYNC_START);
+      } else if (strCmd[2] == '2') {
+        engine_set_sync(SYNC_FOLLOW);
+      } else {
+        engine_set_sync(SYNC_OFF);
+      }
+      print_sync();
+
+    } else if (strcmp(strCmd, "b") == 0) {
+      f_binary = !f_binary;
+      out.print(F("  Output = "));
+      out.println(f_binary ? "binary" : "text");
+
     } else if ((strncmp(strCmd, "DT", 2) == 0) ||
                (strncmp(strCmd, "dt", 2) == 0)) {
-      DT = strtol(&strCmd[2], NULL, 10);
-      DT = constrain(DT, 10, pow(2, 32) - 1);
-      Ser.print("  DT     = ");
-      format_msecs(DT);
-      Ser.println(buf_time);
+      DT = constrain(parse_u64(&strCmd[2]), (uint64_t)dt_min(), DT_MAX);
+      constrain_W();
+      update_train();
+      out.print(F("  DT     = "));
+      format_usecs(DT);
+      out.println(buf_time);
+      out.print(F("  W      = "));
+      format_usecs(W);
+      out.println(buf_time);
+
+    } else if ((strncmp(strCmd, "W", 1) == 0) ||
+               (strncmp(strCmd, "w", 1) == 0)) {
+      W = parse_u64(&strCmd[1]);
+      constrain_W();
+      update_train();
+      out.print(F("  W      = "));
+      format_usecs(W);
+      out.println(buf_time);
+
+    } else if (((strCmd[0] == 'C') || (strCmd[0] == 'c')) &&
+               isdigit(strCmd[1]) && (strCmd[2] == ':')) {
+      process_channel_command(strCmd);
+
+    } else if ((strncmp(strCmd, "SQ", 2) == 0) ||
+               (strncmp(strCmd, "sq", 2) == 0)) {
+      process_sequence_command(strCmd);
+
+    } else if ((strcmp(strCmd, "CALA") == 0) ||
+               (strcmp(strCmd, "cala") == 0)) {
+      int32_t value;
+
+      if (measured_ppb(value)) {
+        engine_set_ppb(value);
+        engine_set_sync(SYNC_OFF);
+      }
+      out.print(F("  PPM    = "));
+      print_ppb(engine_ppb());
+
+    } else if ((strncmp(strCmd, "CAL", 3) == 0) ||
+               (strncmp(strCmd, "cal", 3) == 0)) {
+      if (strCmd[3] != '\0') {
+        cal_period = strtoul(&strCmd[3], NULL, 10);
+        if (cal_period > CAL_PERIOD_MAX) {
+          cal_period = CAL_PERIOD_MAX;
+        }
+        if (f_running) {
+          out.println(F("  Pulse train is running"));
+        } else {
+          engine_set_sync(cal_period ? SYNC_CALIBRATE : SYNC_OFF);
+        }
+      }
+      print_calibration();
+
+    } else if ((strncmp(strCmd, "PPM", 3) == 0) ||
+               (strncmp(strCmd, "ppm", 3) == 0)) {
+      engine_set_ppb(parse_milli(&strCmd[3], PPB_MAX));
+      out.print(F("  PPM    = "));
+      print_ppb(engine_ppb());
+
+    } else if ((strncmp(strCmd, "TRIG", 4) == 0) ||
+               (strncmp(strCmd, "trig", 4) == 0)) {
+      if (f_running) {
+        out.println(F("  Pulse train is running"));
+      } else if (strCmd[4] == '1') {
+        engine_set_trigger(TRIGGER_EDGE);
+      } else if (strCmd[4] == '2') {
+        engine_set_trigger(TRIGGER_GATE);
+      } else {
+        engine_set_trigger(TRIGGER_OFF);
+      }
+      print_trigger();
+
+    } else if ((strncmp(strCmd, "OV", 2) == 0) ||
+               (strncmp(strCmd, "ov", 2) == 0)) {
+      if (strCmd[2] == '1') {
+        engine_set_overrun(OVERRUN_SKIP);
+      } else if (strCmd[2] == '2') {
+        engine_set_overrun(OVERRUN_ABORT);
+      } else {
+        engine_set_overrun(OVERRUN_BURST);
+      }
+      print_overrun();
 
 #ifdef _VARIANT_FEATHER_M4_
-    } else if ((strncmp(strCmd, "T", 1) == 0) ||
-               (strncmp(strCmd, "t", 1) == 0)) {
-      T_meas = strtol(&strCmd[1], NULL, 10);
-      T_meas = constrain(T_meas, 10, pow(2, 32) - 1);
-      Ser.print("  T_meas = ");
-      format_msecs(T_meas);
-      Ser.println(buf_time);
+    } else if (((strCmd[0] == 'T') || (strCmd[0] == 't')) &&
+               isdigit(strCmd[1])) {
+      T_meas = strtoul(&strCmd[1], NULL, 10);
+      if (T_meas < 10) {
+        T_meas = 10;
+      }
+      out.print(F("  T_meas = "));
+      format_usecs((uint64_t)T_meas * 1000);
+      out.println(buf_time);
 #endif
 
     } else if (strcmp(strCmd, "s") == 0) {
@@ -210,67 +1683,66 @@ void loop() {
       }
 
     } else if (!f_running) {
-      // clang-format off
-      Ser.println("-------------------------------------------------------------------");
-      Ser.println("  Arduino trigger box");
-      Ser.println("  https://github.com/Dennis-van-Gils/project-Arduino-trigger-box");
-      Ser.println("");
-      Ser.println("  A configurable TTL pulse train generator on digital outputs");
-      Ser.println("  D05 and D06. Can be used to e.g. trigger (Ximea) cameras to");
-      Ser.println("  acquire pictures in sync with each other using the camera's");
-      Ser.println("  trigger-in port.");
-      Ser.println("-------------------------------------------------------------------");
-      Ser.println("");
-      Ser.println("  <5ms>");
-      Ser.println("  ┌───┐      ┌───┐      ┌───┐");
-      Ser.println("  │   │      │   │      │   │");
-      Ser.println("  │   │      │   │      │   │");
-      Ser.println("  ┘   └──────┘   └──────┘   └────── --> T_meas");
-      Ser.println("  <    DT    >");
-      Ser.println("");
-      Ser.println("  * The pulse period `DT` can be set from 10 msec upwards to hours");
-      Ser.println("    with a resolution of 1 msec.");
-#ifdef _VARIANT_FEATHER_M4_
-      Ser.println("");
-      Ser.println("  * The duration of the pulse train `T_meas`, i.e. the measurement");
-      Ser.println("    time, can be set up to a maximum of 49.7 days.");
-      Ser.println("");
-      Ser.println("  * The RGB LED indicates the status.");
-      Ser.println("    Blue : Idle");
-      Ser.println("    Green: Running pulse train");
-#endif
-      Ser.println("");
-      Ser.println("  * The onboard LED (#13) will flash red with each pulse.");
-      Ser.println("");
-      Ser.println("Commands:");
-      Ser.println("  ?     : Show current settings");
-      Ser.println("  DT... : Set the pulse interval `DT` to ... msecs");
-#ifdef _VARIANT_FEATHER_M4_
-      Ser.println("  T...  : Set the measurement time `T_meas` to ... msecs");
-#endif
-      Ser.println("  s     : Start / stop");
-      Ser.println("");
-      // clang-format on
+      help_pos = help_text;
     }
   }
 
-  now = millis();
+  // Serial output, the pulse reports first
+  if (f_running) {
+    if (out.atLineStart()) {
+      report_pulses();
+    }
 
-#ifdef _VARIANT_FEATHER_M4_
-  if (f_running && (now - t_start >= T_meas)) {
-    f_running = false;
-    stop_train();
+    // The engine stops by itself once `T_meas` has elapsed
+    if (!engine_running()) {
+      f_running = false;
+      stop_train();
+    }
+  }
+
+  if (f_stopping) {
+    finish_stop(false);
+  }
+
+  if (reply) {
+    stream_reply();
+  }
+  if (help_pos) {
+    stream_help();
+  }
+  out.service();
+  if (upload_len) {
+    begin_upload();
+  }
+#ifndef _VARIANT_FEATHER_M4_
+  if (f_baud_pending) {
+    switch_baud();
   }
 #endif
 
-  if (f_running) {
-    if (f_HI && (now - t_HI >= PULSE_WIDTH)) {
-      go_LO();
-    }
+#ifdef _VARIANT_FEATHER_M4_
+  update_neopixel();
+#endif
 
-    if (now - t_HI >= DT) {
-      t_HI += DT; // Keep the interval strict, prevent cumulative error
-      go_HI();
-    }
+  t_loop = micros() - t_loop;
+  if (t_loop > loop_max) {
+    loop_max = t_loop;
   }
-}
\ No newline at end of file
+
+#ifdef _VARIANT_FEATHER_M4_
+  if (neo_pending) {
+    return; // Keep looking for a gap between the edges to show the color
+  }
+#endif
+
+  // Nothing left to do until the next interrupt. The interrupts stay disabled
+  // from the check until the sleep, so that none can slip in between. The
+  // checks only read buffer indices and flags.
+  noInterrupts();
+  if (!Ser.available() && !engine_events_pending() && !help_pos && !reply &&
+      !out.pending() && !out.pendingRecords() && !f_stopping) {
+    idle_sleep();
+  } else {
+    interrupts();
+  }
+}
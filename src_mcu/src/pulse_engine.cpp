@@ -0,0 +1,1273 @@
+/*------------------------------------------------------------------------------
+Pulse engine
+
+Timer set-up, edge scheduling ISR and timeline of the pulse engine, see
+`pulse_engine.h`.
+
+Dennis van Gils
+14-10-2026
+------------------------------------------------------------------------------*/
+
+#include "pulse_engine.h"
+#include "dma_playback.h"
+#include "fast_gpio.h"
+#include "pwm_output.h"
+#include "ring_buffer.h"
+
+// Edges due within this many ticks get busy-waited for inside the ISR, instead
+// of being scheduled on the compare channel. This keeps short pulse widths
+// accurate, as (re)entering the ISR takes longer than that. The compare channel
+// fires this far ahead of each edge, so it has to cover the wake-up from idle
+// sleep, the ISR entry and reading the 64-bit time in `now_ticks()`: Around
+// 200 cycles, i.e. under 2 usec at 120 MHz (Feather M4), but 12 usec at 16 MHz
+// (Uno), where the prologue alone pushes most of the registers.
+#ifdef _VARIANT_FEATHER_M4_
+#define SPIN_TICKS (2 * TICKS_PER_USEC)
+#else
+#define SPIN_TICKS (12 * TICKS_PER_USEC)
+#endif
+
+#ifdef _VARIANT_FEATHER_M4_
+#define TIMER_BITS 32
+#else
+#define TIMER_BITS 16
+#endif
+
+// A compare value closer ahead than this, by the time it got programmed, might
+// be passed by the counter before the match is armed, after which the match
+// would only come around again after a wrap of the counter. The edge then gets
+// busy-waited for instead. Covers the synchronization of the CC register
+// (Feather M4), and the 64-bit arithmetic ahead of writing OCR1A plus the ISR
+// entry and exit (Uno).
+#ifdef _VARIANT_FEATHER_M4_
+#define GUARD_TICKS (1 * TICKS_PER_USEC)
+#else
+#define GUARD_TICKS (8 * TICKS_PER_USEC)
+#endif
+
+// Edges further away than half the counter range get reached in hops, so that
+// we never program a compare value that the counter might already have passed
+#define HOP_TICKS (1UL << (TIMER_BITS - 1))
+
+// Marks a channel that has no more edges to come
+#define NEVER UINT64_MAX
+
+static volatile uint32_t ovf_count = 0; // Number of counter overflows
+static volatile bool f_running = false; // Is pulse train running?
+
+// Run-time state of each channel
+struct Channel {
+  PortMask ports;  // Output pin of this channel
+  uint64_t period; // Pulse period [ticks], 0 when disabled
+  uint64_t width;  // Pulse width [ticks]
+  uint64_t t_HI;   // Time of the current or upcoming rising edge [ticks]
+  uint64_t t_next; // Time of the next edge of this channel [ticks]
+  bool f_HI;       // Is the pulse currently high?
+
+  // Drift correction of the period, `corr + corr_frac / 2^32` ticks, of which
+  // the fractions get accumulated in `corr_acc`
+  int64_t corr;
+  uint32_t corr_frac;
+  uint32_t corr_acc;
+};
+
+static Channel channels[N_CHANNELS];
+
+// Timing staged by `engine_update()`, taken over by each channel at the end of
+// its current period, like the buffered PERBUF/CCBUF registers of a TCC
+struct Shadow {
+  uint64_t period;
+  uint64_t width;
+  int64_t corr;
+  uint32_t corr_frac;
+};
+
+static Shadow shadows[N_CHANNELS];
+static uint8_t shadow_pending = 0; // Bit mask of the channels having one staged
+
+static uint64_t T_meas = 0;    // Duration of the pulse train [ticks]
+static uint64_t t_start = 0;   // Starting time of the pulse train [ticks]
+static uint32_t pulse_idx = 0; // Counter of the rising edges
+
+// The upcoming group of simultaneous edges, precomputed by `plan_next_edge()`
+// so that acting them out takes only the port writes
+static uint64_t t_next = 0;    // Time of the upcoming edges [ticks]
+static PortMask next_set;      // Outputs going high
+static PortMask next_clr;      // Outputs going low
+static uint8_t next_rising;    // Bit mask of the channels going high
+static uint8_t next_falling;   // Bit mask of the channels going low
+
+// Sequence playback, instead of the periodic channels
+static bool f_sequence = false;           // Playing a sequence?
+static const SequenceStep *seq = nullptr; // Table of steps
+static uint16_t seq_len = 0;              // Number of steps in the table
+static uint16_t seq_idx = 0;              // Index of the upcoming step
+static uint32_t seq_repeats = 0;          // Times to play the table, 0: endless
+static uint32_t seq_loop = 0;             // Times the table got played so far
+static uint8_t seq_level = 0;             // Bit mask of the channels now high
+static uint8_t seq_next_level = 0;        // Idem, after the upcoming step
+static bool seq_final = false;            // Is the upcoming step the last one?
+static bool f_dma = false; // Is the sequence played back by DMA instead? The
+                           // compare channel then only serves to stop the
+                           // train once `T_meas` has elapsed.
+static bool f_pwm = false; // Is the pulse train played by the hardware PWM
+                           // instead? Then it needs no compare channel at all.
+#ifndef _VARIANT_FEATHER_M4_
+static volatile uint32_t pwm_ovf = 0; // Overflows of Timer1 under the PWM,
+                                      // one per pulse, kept out of the timeline
+#endif
+
+// All camera outputs
+static PortMask all_outputs;
+static PortMask none;
+#define ALL_CHANNELS ((1 << N_CHANNELS) - 1)
+
+// The outputs belonging to each possible bit mask of channels, so that a
+// sequence step translates into port writes by a mere table lookup
+static PortMask level_ports[1 << N_CHANNELS];
+
+static RingBuffer<PulseEvent, EVENT_BUFFER_LEN> events;
+
+// Drift of the board oscillator w.r.t. the true time [ppb], see
+// `engine_set_ppb()`
+static int32_t ppb = 0;
+
+// Calibration against the reference edges on the sync input
+static volatile uint32_t cal_edges = 0; // Number of reference edges seen
+static uint64_t cal_t_first = 0;        // Time of the first one [ticks]
+static uint64_t cal_t_last = 0;         // Time of the latest one [ticks]
+
+// Exposure capture
+static volatile bool f_capture = false;  // Is the exposure input enabled?
+static volatile bool f_awaiting = false; // Awaiting the exposure of a pulse?
+static uint64_t t_last_rise = 0;         // Time of the latest rising edge
+static uint32_t idx_last_rise = 0;       // Its pulse index
+static LatencyStats latency;
+static HealthStats health;
+static OverrunMode overrun_mode = OVERRUN_BURST;
+static volatile bool f_aborted = false; // Stopped by an overrun?
+static RingBuffer<ExposureEvent, EVENT_BUFFER_LEN> exposures;
+
+// Sync and trigger input
+static SyncMode sync_mode = SYNC_OFF;
+static TriggerMode trigger_mode = TRIGGER_OFF;
+static volatile bool f_armed = false; // Awaiting an input edge to start?
+
+#ifdef BENCH
+static BenchStats bench;
+static uint64_t t_compare = 0; // Time programmed into the compare channel
+#endif
+
+/*------------------------------------------------------------------------------
+  Hardware timer
+------------------------------------------------------------------------------*/
+
+#ifdef _VARIANT_FEATHER_M4_
+
+static inline uint32_t timer_count() {
+  TC2->COUNT32.CTRLBSET.reg = TC_CTRLBSET_CMD_READSYNC;
+  while (TC2->COUNT32.CTRLBSET.bit.CMD) {}
+  return TC2->COUNT32.COUNT.reg;
+}
+
+static inline bool timer_overflow_pending() {
+  return TC2->COUNT32.INTFLAG.bit.OVF;
+}
+
+static inline void timer_set_compare(uint32_t cc) {
+  TC2->COUNT32.CC[0].reg = cc;
+  while (TC2->COUNT32.SYNCBUSY.bit.CC0) {}
+}
+
+static inline void timer_enable_compare() {
+  TC2->COUNT32.INTFLAG.reg = TC_INTFLAG_MC0;
+  TC2->COUNT32.INTENSET.reg = TC_INTENSET_MC0;
+}
+
+static inline void timer_disable_compare() {
+  TC2->COUNT32.INTENCLR.reg = TC_INTENCLR_MC0;
+}
+
+static void capture_isr();
+
+// The exposure input gets timestamped from its EIC interrupt, as the compare
+// channels of TC2 are taken. This adds the interrupt latency of about 1 usec.
+static void capture_enable() {
+  attachInterrupt(digitalPinToInterrupt(PIN_EXPOSURE), capture_isr, RISING);
+}
+
+static void capture_disable() {
+  detachInterrupt(digitalPinToInterrupt(PIN_EXPOSURE));
+}
+
+static void timer_begin() {
+  // TC2 is the master of the 32-bit pair, TC3 its slave. Both share the same
+  // peripheral clock channel.
+  MCLK->APBBMASK.reg |= MCLK_APBBMASK_TC2 | MCLK_APBBMASK_TC3;
+  GCLK->PCHCTRL[TC2_GCLK_ID].reg = GCLK_PCHCTRL_GEN_GCLK1 | GCLK_PCHCTRL_CHEN;
+  while (!(GCLK->PCHCTRL[TC2_GCLK_ID].reg & GCLK_PCHCTRL_CHEN)) {}
+
+  TC2->COUNT32.CTRLA.bit.ENABLE = 0;
+  while (TC2->COUNT32.SYNCBUSY.bit.ENABLE) {}
+  TC2->COUNT32.CTRLA.reg = TC_CTRLA_SWRST;
+  while (TC2->COUNT32.SYNCBUSY.bit.SWRST) {}
+
+  TC2->COUNT32.CTRLA.reg = TC_CTRLA_MODE_COUNT32 | TC_CTRLA_PRESCALER_DIV1;
+  TC2->COUNT32.WAVE.reg = TC_WAVE_WAVEGEN_NFRQ; // Free-running up to 2^32 - 1
+  TC2->COUNT32.INTFLAG.reg = TC_INTFLAG_OVF | TC_INTFLAG_MC0;
+  TC2->COUNT32.INTENSET.reg = TC_INTENSET_OVF;
+
+  NVIC_ClearPendingIRQ(TC2_IRQn);
+  NVIC_SetPriority(TC2_IRQn, 0); // Highest priority
+  NVIC_EnableIRQ(TC2_IRQn);
+
+  TC2->COUNT32.CTRLA.bit.ENABLE = 1;
+  while (TC2->COUNT32.SYNCBUSY.bit.ENABLE) {}
+}
+
+#else
+
+static inline uint16_t timer_count() { return TCNT1; }
+
+static inline bool timer_overflow_pending() { return TIFR1 & _BV(TOV1); }
+
+static inline void timer_set_compare(uint16_t cc) { OCR1A = cc; }
+
+static inline void timer_enable_compare() {
+  TIFR1 = _BV(OCF1A); // Writing a logic one clears the flag
+  TIMSK1 |= _BV(OCIE1A);
+}
+
+static inline void timer_disable_compare() { TIMSK1 &= ~_BV(OCIE1A); }
+
+// The exposure input is the input capture pin ICP1, so Timer1 itself latches
+// the count at the edge, with the noise canceler adding 4 CPU cycles
+static void capture_enable() {
+  TCCR1B |= _BV(ICNC1) | _BV(ICES1); // Rising edge
+  TIFR1 = _BV(ICF1);
+  TIMSK1 |= _BV(ICIE1);
+}
+
+static void capture_disable() { TIMSK1 &= ~_BV(ICIE1); }
+
+static void timer_begin() {
+  TCCR1A = 0;          // Normal mode, output compare pins disconnected
+  TCCR1B = _BV(CS11);  // Prescaler 8
+  TCNT1 = 0;
+  TIFR1 = _BV(TOV1) | _BV(OCF1A);
+  TIMSK1 = _BV(TOIE1); // Overflow interrupt
+}
+
+// Hand Timer1 back to the timeline at time `t` [ticks], after the hardware PWM
+// had it. Leaves the enabled interrupts as they are, and restores the set-up of
+// the input capture.
+static void timer_resume(uint64_t t) {
+  TCCR1B = 0; // Stop the clock
+  TCCR1A = 0;
+  ovf_count = t >> TIMER_BITS;
+  TCNT1 = (uint16_t)t;
+  TIFR1 = _BV(TOV1) | _BV(OCF1A) | _BV(OCF1B) | _BV(ICF1);
+  TCCR1B = f_capture ? _BV(ICNC1) | _BV(ICES1) | _BV(CS11) : _BV(CS11);
+}
+
+#endif
+
+/*------------------------------------------------------------------------------
+  Timeline
+------------------------------------------------------------------------------*/
+
+// Extend the counter value `lo`, read or captured just now, to the 64-bit
+// timeline. Must be called with interrupts disabled.
+static uint64_t extend_ticks(uint32_t lo) {
+  uint32_t hi = ovf_count;
+
+  // An overflow might have occurred that has not yet been serviced by its ISR
+  if (timer_overflow_pending() && (lo < HOP_TICKS)) {
+    hi++;
+  }
+
+  return ((uint64_t)hi << TIMER_BITS) | lo;
+}
+
+// Current time [ticks]. Must be called with interrupts disabled, i.e. from
+// inside an ISR or guarded by `noInterrupts()`.
+static uint64_t now_ticks() {
+#ifndef _VARIANT_FEATHER_M4_
+  if (f_pwm && !f_armed) {
+    // Timer1 plays the PWM, counting the time since it got started
+    uint32_t n_ovf = pwm_ovf;
+    return t_start + pwm_output_elapsed(n_ovf);
+  }
+#endif
+  return extend_ticks(timer_count());
+}
+
+uint64_t engine_now() {
+  uint64_t t;
+
+  noInterrupts();
+  t = now_ticks();
+  interrupts();
+
+  return t;
+}
+
+/*------------------------------------------------------------------------------
+  Edges
+------------------------------------------------------------------------------*/
+
+static void portmask_or(PortMask &dest, const PortMask &src) {
+  for (uint8_t i = 0; i < N_PORTS; i++) {
+    dest.port[i] |= src.port[i];
+  }
+}
+
+// Split the drift correction of a duration of `ticks` into whole ticks and a
+// 32-bit fraction of a tick, the latter always being positive. Exact integer
+// math, as the 64-bit divisions only take place when starting.
+static void split_correction(uint64_t ticks, int64_t &whole, uint32_t &frac) {
+  const uint64_t GIGA = 1000000000ULL;
+  uint32_t mag = (ppb < 0) ? -ppb : ppb;
+  uint64_t prod = (ticks % GIGA) * mag; // Less than 2^50
+  uint64_t w = (ticks / GIGA) * mag + prod / GIGA;
+  uint32_t f = ((prod % GIGA) << 32) / GIGA;
+
+  if (ppb >= 0) {
+    whole = w;
+    frac = f;
+  } else if (f) {
+    whole = -(int64_t)w - 1;
+    frac = -f; // I.e. 2^32 - f
+  } else {
+    whole = -(int64_t)w;
+    frac = 0;
+  }
+}
+
+// Advance the rising edge of channel `ch` by one drift-corrected period
+static inline void advance_period(Channel &ch) {
+  uint32_t acc = ch.corr_acc + ch.corr_frac;
+
+  ch.t_HI += ch.period + ch.corr + (acc < ch.corr_acc); // Carry of the fraction
+  ch.corr_acc = acc;
+}
+
+// Take over the staged timing of channel `i`, if any
+static inline void apply_shadow(uint8_t i) {
+  if (!(shadow_pending & (1 << i))) {
+    return;
+  }
+  Channel &ch = channels[i];
+  Shadow &sh = shadows[i];
+
+  ch.period = sh.period;
+  ch.width = sh.width;
+  ch.corr = sh.corr;
+  ch.corr_frac = sh.corr_frac;
+  shadow_pending &= ~(1 << i);
+}
+
+// Record the rising edges that just got written to the ports. The time gets
+// latched from the counter right after the port write, so that it reflects
+// when the outputs actually toggled instead of when they were scheduled to.
+static inline void record_rising() {
+  uint64_t t_edge = now_ticks();
+
+  // `t_next` is the ideal time of the edge, e.g. `t_start + k * DT`. The
+  // lateness fits the lower 32 bits, which is cheaper on the AVR.
+  uint32_t late = (uint32_t)t_edge - (uint32_t)t_next;
+  health.pulses++;
+  if (late > health.late_max) {
+    health.late_max = late;
+  }
+  if (late > LATE_TICKS) {
+    health.late_n++;
+  }
+
+#ifdef BENCH
+  uint32_t bin = late / BENCH_BIN_TICKS;
+  bench.late_hist[bin < BENCH_BINS ? bin : BENCH_BINS - 1]++;
+  if (late > bench.late_max) {
+    bench.late_max = late;
+  }
+#endif
+
+  pulse_idx++;
+  if (!events.push({next_rising, pulse_idx, t_edge - t_start})) {
+    health.dropped++;
+  }
+
+  if (f_capture) {
+    if (f_awaiting) {
+      latency.missed++; // The previous pulse got no exposure
+    }
+    t_last_rise = t_edge;
+    idx_last_rise = pulse_idx;
+    f_awaiting = true;
+  }
+}
+
+// Find the earliest edge(s) among all channels and precompute what to write
+static void plan_next_channel_edge() {
+  t_next = NEVER;
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    if (channels[i].t_next < t_next) {
+      t_next = channels[i].t_next;
+    }
+  }
+
+  if (t_next == NEVER) {
+    f_running = false;
+    return;
+  }
+
+  portmask_clear(next_set);
+  portmask_clear(next_clr);
+  next_rising = 0;
+  next_falling = 0;
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    Channel &ch = channels[i];
+    if (ch.t_next != t_next) {
+      continue;
+    }
+    if (ch.f_HI) {
+      portmask_or(next_clr, ch.ports);
+      next_falling |= 1 << i;
+    } else {
+      portmask_or(next_set, ch.ports);
+      next_rising |= 1 << i;
+    }
+  }
+}
+
+// Act out the edges of the channels scheduled at `t_next` and plan the next
+// ones
+static void next_channel_edge() {
+  gpio_write(next_set, next_clr);
+
+  if (next_rising) {
+    record_rising();
+  }
+
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    Channel &ch = channels[i];
+
+    if (next_rising & (1 << i)) {
+      ch.f_HI = true;
+      ch.t_next = ch.t_HI + ch.width;
+
+    } else if (next_falling & (1 << i)) {
+      ch.f_HI = false;
+      advance_period(ch); // Keep the interval strict, no cumulative error
+      apply_shadow(i);    // The new period starts at the upcoming rising edge
+
+      if ((ch.period == 0) || (T_meas && (ch.t_HI - t_start >= T_meas))) {
+        ch.t_next = NEVER;
+      } else {
+        ch.t_next = ch.t_HI;
+      }
+    }
+  }
+
+  plan_next_channel_edge();
+}
+
+// Precompute the port writes of the sequence step at `t_next`. Once the table
+// has been played `seq_repeats` times, or once `T_meas` has elapsed, the final
+// step pulls all outputs low.
+static void plan_next_step() {
+  if (seq_idx == seq_len) {
+    seq_idx = 0;
+    seq_loop++;
+  }
+
+  seq_final = (seq_repeats && (seq_loop >= seq_repeats)) ||
+              (T_meas && (t_next - t_start >= T_meas));
+  seq_next_level = seq_final ? 0 : seq[seq_idx].mask & ALL_CHANNELS;
+  next_set = level_ports[seq_next_level];
+  next_clr = level_ports[~seq_next_level & ALL_CHANNELS];
+  next_rising = seq_next_level & ~seq_level;
+}
+
+// Act out the sequence step scheduled at `t_next` and plan the next one
+static void next_step() {
+  gpio_write(next_set, next_clr);
+
+  if (next_rising) {
+    record_rising();
+  }
+
+  seq_level = seq_next_level;
+  if (seq_final) {
+    f_running = false;
+    return;
+  }
+
+  t_next += seq[seq_idx].delta;
+  seq_idx++;
+  plan_next_step();
+}
+
+static inline void next_edge() {
+#ifdef _VARIANT_FEATHER_M4_
+  if (f_dma) {
+    dma_playback_stop();
+    gpio_write(none, all_outputs);
+    f_running = false;
+    return;
+  }
+#endif
+
+  if (f_sequence) {
+    next_step();
+  } else {
+    next_channel_edge();
+  }
+}
+
+static void halt();
+
+// Has the slot of the upcoming rising edges fully passed at time `now`?
+static bool missed_slot(uint64_t now) {
+  if (!next_rising) {
+    return false; // Late falling edges only stretch the pulse
+  }
+
+  if (f_sequence) {
+    return !seq_final && (t_next + seq[seq_idx].delta <= now);
+  }
+
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    if ((next_rising & (1 << i)) &&
+        (channels[i].t_HI + channels[i].width <= now)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Skip the pulses or sequence steps whose slot has passed at time `now`
+static void skip_missed(uint64_t now) {
+  if (f_sequence) {
+    while (!seq_final && (t_next + seq[seq_idx].delta <= now)) {
+      t_next += seq[seq_idx].delta;
+      seq_idx++;
+      health.skipped++;
+      plan_next_step();
+    }
+    return;
+  }
+
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    Channel &ch = channels[i];
+
+    if (!(next_rising & (1 << i)) || (ch.t_HI + ch.width > now)) {
+      continue;
+    }
+    while (ch.t_HI <= now) {
+      advance_period(ch); // Stays aligned to `t_start + k * period`
+      health.skipped++;
+    }
+    if (T_meas && (ch.t_HI - t_start >= T_meas)) {
+      ch.t_next = NEVER;
+    } else {
+      ch.t_next = ch.t_HI;
+    }
+  }
+  plan_next_channel_edge();
+}
+
+// The scheduler has fallen behind at time `now`, act out the overrun policy
+static void overrun(uint64_t now) {
+  health.overruns++;
+
+  if (overrun_mode == OVERRUN_SKIP) {
+    skip_missed(now);
+  } else if (overrun_mode == OVERRUN_ABORT) {
+    f_aborted = true;
+    halt();
+  }
+}
+
+// Program the compare channel to match at time `t`
+static inline void set_compare(uint64_t t) {
+#ifdef BENCH
+  t_compare = t;
+#endif
+  timer_set_compare((uint32_t)t);
+}
+
+#ifdef BENCH
+// Keep track of how late the ISR got entered after the compare match
+static inline void bench_isr_entry() {
+  uint32_t delay = now_ticks() - t_compare;
+
+  bench.isr_n++;
+  if (delay > bench.isr_max) {
+    bench.isr_max = delay;
+  }
+}
+#endif
+
+// Service the compare channel: Act out all edges that are due and program the
+// compare value for the next one
+static void service_compare() {
+  while (f_running) {
+    uint64_t now = now_ticks();
+    int64_t remaining = (int64_t)(t_next - now);
+
+    if (remaining > (int64_t)(SPIN_TICKS + GUARD_TICKS)) {
+      uint64_t t_cmp = (remaining > (int64_t)HOP_TICKS) ? now + HOP_TICKS
+                                                         : t_next - SPIN_TICKS;
+
+      set_compare(t_cmp);
+      if ((int64_t)(t_cmp - now_ticks()) > (int64_t)GUARD_TICKS) {
+        return;
+      }
+      continue; // Too close by now to rely on the match: Busy-wait instead
+    }
+
+    if ((remaining < 0) && !f_dma && missed_slot(now)) {
+      overrun(now);
+      if (overrun_mode != OVERRUN_BURST) {
+        continue; // Replanned, or halted
+      }
+    }
+
+    while ((int64_t)(t_next - now_ticks()) > 0) {}
+    next_edge();
+  }
+
+  timer_disable_compare();
+}
+
+#ifdef _VARIANT_FEATHER_M4_
+
+void TC2_Handler() {
+  if (TC2->COUNT32.INTFLAG.bit.OVF) {
+    TC2->COUNT32.INTFLAG.reg = TC_INTFLAG_OVF;
+    ovf_count++;
+  }
+
+  if (TC2->COUNT32.INTFLAG.bit.MC0) {
+    TC2->COUNT32.INTFLAG.reg = TC_INTFLAG_MC0;
+#ifdef BENCH
+    bench_isr_entry();
+#endif
+    service_compare();
+  }
+}
+
+#else
+
+ISR(TIMER1_OVF_vect) {
+  // Under the hardware PWM each overflow is the start of a pulse instead
+  if (f_pwm && !f_armed) {
+    pwm_ovf++;
+  } else {
+    ovf_count++;
+  }
+}
+
+ISR(TIMER1_COMPA_vect) {
+#ifdef BENCH
+  bench_isr_entry();
+#endif
+  service_compare();
+}
+
+#endif
+
+/*------------------------------------------------------------------------------
+  Exposure capture
+------------------------------------------------------------------------------*/
+
+// Match the exposure edge at time `t` to the latest rising edge
+static void capture_exposure(uint64_t t) {
+  uint64_t ticks = t - t_last_rise;
+  uint32_t dt = (ticks > UINT32_MAX) ? UINT32_MAX : (uint32_t)ticks;
+
+  if (!f_awaiting) {
+    latency.unmatched++; // Exposure without a pulse to go with
+    return;
+  }
+  f_awaiting = false;
+
+  if (latency.n == 0 || dt < latency.min) {
+    latency.min = dt;
+  }
+  if (dt > latency.max) {
+    latency.max = dt;
+  }
+  latency.sum += dt;
+  latency.n++;
+
+  if (!exposures.push({idx_last_rise, dt})) {
+    health.dropped++;
+  }
+}
+
+#ifdef _VARIANT_FEATHER_M4_
+
+static void capture_isr() {
+  noInterrupts(); // Keep TC2 from servicing an overflow in between
+  capture_exposure(now_ticks());
+  interrupts();
+}
+
+#else
+
+ISR(TIMER1_CAPT_vect) { capture_exposure(extend_ticks(ICR1)); }
+
+#endif
+
+static void reset_capture() {
+  f_awaiting = false;
+  memset(&latency, 0, sizeof(latency));
+  exposures.reset();
+}
+
+// Is the pulse train played by hardware, leaving the inputs out?
+static inline bool by_hardware() { return f_dma || f_pwm; }
+
+// Stop the pulse train immediately and pull all outputs low. Must be called
+// with interrupts disabled.
+static void halt() {
+  if (f_pwm && !f_armed) {
+#ifdef _VARIANT_FEATHER_M4_
+    pwm_output_stop();
+    pulse_idx = pwm_output_pulses();
+#else
+    // The timeline carries on from the time the PWM has played
+    uint32_t n_ovf = pwm_ovf;
+    uint64_t t = t_start + pwm_output_elapsed(n_ovf);
+
+    pwm_output_stop();
+    timer_resume(t);
+    pulse_idx = n_ovf;
+#endif
+    health.pulses += pulse_idx;
+  }
+  f_pwm = false;
+  f_running = false;
+  f_armed = false;
+  timer_disable_compare();
+#ifdef _VARIANT_FEATHER_M4_
+  if (f_dma) {
+    dma_playback_stop();
+    f_dma = false;
+  }
+#endif
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    channels[i].f_HI = false;
+  }
+  seq_level = 0;
+  gpio_write(none, all_outputs);
+}
+
+/*------------------------------------------------------------------------------
+  Sync and trigger input
+------------------------------------------------------------------------------*/
+
+// Shift the whole schedule by `dt` ticks, which may be negative
+static void shift_schedule(int64_t dt) {
+  t_start += dt;
+  if (t_next != NEVER) {
+    t_next += dt;
+  }
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    Channel &ch = channels[i];
+    ch.t_HI += dt;
+    if (ch.t_next != NEVER) {
+      ch.t_next += dt;
+    }
+  }
+}
+
+// Re-phase the periodic channels, such that the rising edge of channel 1
+// nearest to the sync edge at `t` coincides with it
+static void rephase(uint64_t t) {
+  Channel &ch = channels[0];
+  uint64_t t_prev; // Latest rising edge of channel 1, on or before `t_HI`
+  int64_t err_prev;
+  int64_t err_next;
+  int64_t abs_prev; // `llabs()` is missing from the avr-libc
+  int64_t abs_next;
+
+  if (f_sequence || !ch.period || (ch.t_next == NEVER)) {
+    return;
+  }
+
+  t_prev = ch.f_HI ? ch.t_HI : ch.t_HI - ch.period;
+  err_prev = (int64_t)(t - t_prev);
+  err_next = err_prev - (int64_t)ch.period;
+  abs_prev = (err_prev < 0) ? -err_prev : err_prev;
+  abs_next = (err_next < 0) ? -err_next : err_next;
+  shift_schedule(abs_prev <= abs_next ? err_prev : err_next);
+}
+
+// Start the armed pulse train as if it got started at time `t`
+static void fire(uint64_t t) {
+  f_armed = false;
+  if (f_pwm) {
+    // The hardware starts right away, as the pulses are not on the timeline
+    t_start = extend_ticks(timer_count());
+#ifndef _VARIANT_FEATHER_M4_
+    pwm_ovf = 0;
+#endif
+    pwm_output_start();
+    return;
+  }
+#ifdef _VARIANT_FEATHER_M4_
+  if (f_dma) {
+    t_start = t;
+    dma_playback_start(t - now_ticks());
+    if (T_meas) {
+      t_next = t_start + T_meas;
+      set_compare(t_next - SPIN_TICKS);
+      timer_enable_compare();
+    }
+    return;
+  }
+#endif
+  shift_schedule(t - t_start);
+  timer_enable_compare();
+
+  // Edges that are already due get acted out right away, and the compare
+  // channel gets programmed for the shifted schedule
+  service_compare();
+}
+
+// The sync edge at time `t` either starts the armed pulse train, as if it got
+// started at the edge, or re-phases the running one, or serves as calibration
+// reference
+static void sync_edge(uint64_t t) {
+  if (sync_mode == SYNC_CALIBRATE) {
+    if (cal_edges == 0) {
+      cal_t_first = t;
+    }
+    cal_t_last = t;
+    cal_edges++;
+  } else if (f_armed && !by_hardware()) {
+    fire(t);
+  } else if ((sync_mode == SYNC_FOLLOW) && f_running && !by_hardware()) {
+    rephase(t);
+    service_compare();
+  }
+}
+
+static void sync_isr() {
+  noInterrupts(); // Keep the timer ISR from running in between
+  sync_edge(now_ticks());
+  interrupts();
+}
+
+// A rising edge at time `t` starts the armed pulse train `TRIGGER_LEAD` later,
+// so that the first edge gets scheduled on the compare channel instead of being
+// acted out late. In gate mode a falling edge stops it.
+static void trigger_isr() {
+  noInterrupts(); // Keep the timer ISR from running in between
+  uint64_t t = now_ticks();
+
+  if ((trigger_mode == TRIGGER_EDGE) || digitalRead(PIN_TRIGGER)) {
+    if (f_armed && !by_hardware()) {
+      fire(t + TRIGGER_LEAD);
+    }
+  } else if (f_running && !f_armed) {
+    halt();
+  }
+  interrupts();
+}
+
+/*------------------------------------------------------------------------------
+  Public
+------------------------------------------------------------------------------*/
+
+void engine_begin() {
+  portmask_clear(all_outputs);
+  portmask_clear(none);
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    portmask_clear(channels[i].ports);
+    portmask_add_pin(channels[i].ports, channel_pins[i]);
+    portmask_or(all_outputs, channels[i].ports);
+  }
+
+  // The onboard LED and the sync output follow the first channel
+  portmask_add_pin(channels[0].ports, LED_BUILTIN);
+  portmask_add_pin(all_outputs, LED_BUILTIN);
+  portmask_add_pin(channels[0].ports, PIN_SYNC_OUT);
+  portmask_add_pin(all_outputs, PIN_SYNC_OUT);
+
+  for (uint16_t mask = 0; mask <= ALL_CHANNELS; mask++) {
+    portmask_clear(level_ports[mask]);
+    for (uint8_t i = 0; i < N_CHANNELS; i++) {
+      if (mask & (1 << i)) {
+        portmask_or(level_ports[mask], channels[i].ports);
+      }
+    }
+  }
+
+  timer_begin();
+}
+
+// Await `fire()` for the planned edges
+static void arm() {
+  f_running = true;
+  f_armed = true;
+  f_aborted = false;
+#ifdef BENCH
+  memset(&bench, 0, sizeof(bench));
+#endif
+}
+
+// Is the armed pulse train to be fired by the sync or trigger input?
+static bool awaits_input() {
+  return !by_hardware() &&
+         ((sync_mode == SYNC_START) || (sync_mode == SYNC_FOLLOW) ||
+          (trigger_mode != TRIGGER_OFF));
+}
+
+// Apply the drift correction to `T_meas`
+static uint64_t correct_duration(uint64_t ticks) {
+  int64_t whole;
+  uint32_t frac;
+
+  split_correction(ticks, whole, frac);
+  return ticks + whole;
+}
+
+void engine_arm(const ChannelTiming *timing, uint64_t T_meas_) {
+  // The train is not running, so the channels are ours to prepare
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    Channel &ch = channels[i];
+    split_correction(timing[i].period, ch.corr, ch.corr_frac);
+    ch.corr_acc = 0;
+  }
+  T_meas_ = correct_duration(T_meas_);
+
+  noInterrupts();
+  f_sequence = false;
+  f_dma = false;
+  f_pwm = false;
+  shadow_pending = 0;
+  reset_capture();
+  T_meas = T_meas_;
+  pulse_idx = 0;
+  events.reset();
+  t_start = now_ticks() + START_LEAD;
+
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    Channel &ch = channels[i];
+    ch.period = timing[i].period;
+    ch.width = timing[i].width;
+    ch.f_HI = false;
+    ch.t_HI = t_start + timing[i].offset;
+    if ((ch.period == 0) ||
+        (T_meas && (timing[i].offset >= T_meas))) {
+      ch.t_next = NEVER;
+    } else {
+      ch.t_next = ch.t_HI;
+    }
+  }
+
+  f_running = true;
+  plan_next_channel_edge();
+  if (f_running) {
+    arm();
+  }
+  interrupts();
+}
+
+void engine_arm_sequence(const SequenceStep *steps, uint16_t n_steps,
+                         uint32_t repeats, uint64_t T_meas_) {
+  if (n_steps == 0) {
+    return;
+  }
+
+  T_meas_ = correct_duration(T_meas_);
+
+  noInterrupts();
+  f_sequence = true;
+  f_dma = false;
+  f_pwm = false;
+  reset_capture();
+  seq = steps;
+  seq_len = n_steps;
+  seq_idx = 0;
+  seq_repeats = repeats;
+  seq_loop = 0;
+  seq_level = 0;
+  T_meas = T_meas_;
+  pulse_idx = 0;
+  events.reset();
+  t_start = t_next = now_ticks() + START_LEAD;
+
+  plan_next_step();
+  arm();
+  interrupts();
+}
+
+#ifdef _VARIANT_FEATHER_M4_
+
+bool engine_arm_sequence_dma(const SequenceStep *steps, uint16_t n_steps,
+                             uint32_t repeats, uint64_t T_meas_) {
+  if (!dma_playback_load(steps, n_steps, level_ports, repeats)) {
+    return false;
+  }
+  T_meas_ = correct_duration(T_meas_);
+
+  noInterrupts();
+  f_sequence = false;
+  f_dma = true;
+  f_pwm = false;
+  reset_capture();
+  T_meas = T_meas_;
+  pulse_idx = 0;
+  events.reset();
+  t_start = now_ticks() + START_LEAD;
+  arm();
+  interrupts();
+
+  return true;
+}
+
+#endif
+
+bool engine_arm_pwm(const ChannelTiming *timing, uint64_t T_meas_) {
+  uint8_t mask = 0;    // Channels firing
+  uint64_t period = 0; // Their common period [ticks]
+  uint64_t width = 0;  // Their common pulse width [ticks]
+  uint64_t n_pulses = 0;
+
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    if (!timing[i].period) {
+      continue;
+    }
+    if (timing[i].offset ||
+        (mask && ((timing[i].period != period) ||
+                  (timing[i].width != width)))) {
+      return false;
+    }
+    period = timing[i].period;
+    width = timing[i].width;
+    mask |= 1 << i;
+  }
+  if (ppb || f_capture || (period > PWM_MAX_TICKS)) {
+    return false;
+  }
+
+  // The pulses whose rising edge falls within `T_meas`
+  if (T_meas_) {
+    n_pulses = min((T_meas_ + period - 1) / period, (uint64_t)UINT32_MAX);
+  }
+  if (!pwm_output_load(mask, period, width, n_pulses)) {
+    return false;
+  }
+
+  noInterrupts();
+  f_sequence = false;
+  f_dma = false;
+  f_pwm = true;
+  shadow_pending = 0;
+  reset_capture();
+  T_meas = T_meas_;
+  pulse_idx = 0;
+  events.reset();
+  t_start = now_ticks() + START_LEAD;
+  arm();
+  interrupts();
+
+  return true;
+}
+
+bool engine_fire() {
+  bool f_fired = false;
+
+  noInterrupts();
+  if (f_armed && !awaits_input()) {
+    fire(now_ticks() + START_LEAD);
+    f_fired = true;
+  }
+  interrupts();
+
+  return f_fired;
+}
+
+bool engine_update(const ChannelTiming *timing) {
+  Shadow staged[N_CHANNELS];
+
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    staged[i].period = timing[i].period;
+    staged[i].width = timing[i].width;
+    split_correction(timing[i].period, staged[i].corr, staged[i].corr_frac);
+  }
+
+  noInterrupts();
+  if (!f_running || f_sequence || by_hardware()) {
+    interrupts();
+    return false;
+  }
+
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    if (channels[i].t_next == NEVER) {
+      continue; // Off, or done for this train
+    }
+    shadows[i] = staged[i];
+    shadow_pending |= 1 << i;
+    if (f_armed) {
+      // No period has started yet
+      apply_shadow(i);
+      if (channels[i].period == 0) {
+        channels[i].t_next = NEVER;
+      }
+    }
+  }
+  if (f_armed) {
+    plan_next_channel_edge();
+    f_armed = f_running;
+  }
+  interrupts();
+
+  return true;
+}
+
+void engine_stop() {
+  noInterrupts();
+  halt();
+  interrupts();
+}
+
+bool engine_running() {
+#ifdef _VARIANT_FEATHER_M4_
+  if (f_dma && !dma_playback_running()) {
+    return false; // All repeats have been played
+  }
+  if (f_pwm && !f_armed && !pwm_output_running()) {
+    return false; // All pulses have been fired
+  }
+#endif
+  return f_running;
+}
+
+bool engine_quiet_for(uint32_t ticks) {
+  bool f_quiet;
+
+  noInterrupts();
+  if (f_armed) {
+    f_quiet = false; // The input edge might come at any moment
+  } else if (!f_running || by_hardware()) {
+    f_quiet = true;
+  } else {
+    f_quiet = (int64_t)(t_next - now_ticks()) > (int64_t)ticks;
+  }
+  interrupts();
+
+  return f_quiet;
+}
+
+bool engine_pop_event(PulseEvent &ev) { return events.pop(ev); }
+
+bool engine_events_pending() {
+  return events.count() || exposures.count();
+}
+
+uint32_t engine_dropped_events() {
+  return events.dropped() + exposures.dropped();
+}
+
+bool engine_capture(bool f_enable) {
+  if (f_enable && f_pwm) {
+    return false;
+  }
+
+  noInterrupts();
+  reset_capture();
+  f_capture = f_enable;
+  interrupts();
+
+  if (f_enable) {
+    pinMode(PIN_EXPOSURE, INPUT);
+    capture_enable();
+  } else {
+    capture_disable();
+  }
+
+  return true;
+}
+
+bool engine_capturing() { return f_capture; }
+
+void engine_set_sync(SyncMode mode) {
+  noInterrupts();
+  cal_edges = 0;
+  interrupts();
+
+  if (mode == SYNC_OFF) {
+    detachInterrupt(digitalPinToInterrupt(PIN_SYNC_IN));
+  } else if (sync_mode == SYNC_OFF) {
+    pinMode(PIN_SYNC_IN, INPUT);
+    attachInterrupt(digitalPinToInterrupt(PIN_SYNC_IN), sync_isr, RISING);
+  }
+  sync_mode = mode;
+}
+
+SyncMode engine_sync() { return sync_mode; }
+
+void engine_set_trigger(TriggerMode mode) {
+  detachInterrupt(digitalPinToInterrupt(PIN_TRIGGER));
+  if (mode != TRIGGER_OFF) {
+    pinMode(PIN_TRIGGER, INPUT);
+    attachInterrupt(digitalPinToInterrupt(PIN_TRIGGER), trigger_isr,
+                    (mode == TRIGGER_GATE) ? CHANGE : RISING);
+  }
+  trigger_mode = mode;
+}
+
+TriggerMode engine_trigger() { return trigger_mode; }
+
+uint32_t engine_calibration(uint64_t &span) {
+  uint32_t n;
+
+  noInterrupts();
+  n = cal_edges;
+  span = cal_t_last - cal_t_first;
+  interrupts();
+
+  return n;
+}
+
+void engine_set_ppb(int32_t ppb_) {
+  ppb = constrain(ppb_, -PPB_MAX, PPB_MAX);
+}
+
+int32_t engine_ppb() { return ppb; }
+
+bool engine_armed() { return f_armed; }
+
+bool engine_pop_exposure(ExposureEvent &ev) { return exposures.pop(ev); }
+
+void engine_latency_stats(LatencyStats &stats) {
+  noInterrupts();
+  stats = latency;
+  interrupts();
+}
+
+void engine_health(HealthStats &stats) {
+  noInterrupts();
+  stats = health;
+  interrupts();
+}
+
+void engine_set_overrun(OverrunMode mode) { overrun_mode = mode; }
+
+OverrunMode engine_overrun() { return overrun_mode; }
+
+bool engine_aborted() { return f_aborted; }
+
+#ifdef BENCH
+void engine_bench(BenchStats &stats) {
+  noInterrupts();
+  stats = bench;
+  interrupts();
+}
+#endif
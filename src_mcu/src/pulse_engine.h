@@ -0,0 +1,391 @@
+/*------------------------------------------------------------------------------
+Pulse engine
+
+Generates the TTL pulse train on the camera outputs from within the interrupt
+service routine of a hardware timer, instead of polling `millis()` in `loop()`.
+Each edge gets scheduled on a compare channel of a free-running counter, so the
+edge timing no longer depends on how busy `loop()` is.
+
+  * Adafruit Feather M4 Express:
+    TC2 and TC3 are paired into a 32-bit counter, clocked by GCLK1 at 48 MHz.
+  * Arduino Uno:
+    Timer1 runs as a 16-bit counter with a prescaler of 8, i.e. at 2 MHz. This
+    disables PWM on pins D09 and D10.
+
+The hardware counter is extended in software to a 64-bit tick count by counting
+its overflows. Hence, the timeline will not wrap around for centuries.
+
+Alternatively, the ISR plays back a precomputed table of `SequenceStep`s, for
+arbitrary trigger patterns like bursts. Each step then takes no more than two
+table lookups and an index increment. On the Feather M4 such a table can also
+be played back by DMA, see `dma_playback.h`.
+
+Each output channel has its own period, phase offset and pulse width. The ISR
+merges the edges of all channels into a single schedule: Edges of different
+channels that fall on the same tick get acted out together. The outputs get
+driven by direct port writes, see `fast_gpio.h`, so that these cameras receive
+their edges simultaneously.
+
+The ISR does not report anything over serial itself. It only records each
+rising edge as a `PulseEvent` in a lock-free ring buffer, see `ring_buffer.h`,
+which the main loop drains and formats whenever it has time to do so. When the
+main loop can not keep up, the events get dropped and counted instead.
+
+The time of each event gets latched from the hardware counter right after the
+port write, so it is the true edge time rather than the scheduled one. It lags
+the edge by no more than the read-out of the counter: A few ticks on the
+Feather M4, due to the read synchronization of the TC, and 1 tick on the Uno.
+
+Dennis van Gils
+14-10-2026
+------------------------------------------------------------------------------*/
+
+#ifndef PULSE_ENGINE_H
+#define PULSE_ENGINE_H
+
+#include <Arduino.h>
+
+#define PIN_CAM_1 5
+#define PIN_CAM_2 6
+
+// Output pins of the channels, channel 1 first. Can be overridden by a build
+// flag in `platformio.ini`, e.g. `-D CAM_PINS=5,6,9,10`. At most 8 channels.
+// Channels that share a port get switched by a single register write, so for
+// the least skew pick the pins from one port, see `fast_gpio.h`.
+#ifndef CAM_PINS
+#define CAM_PINS PIN_CAM_1, PIN_CAM_2
+#endif
+
+// Input of the "exposure active" return signal of a camera, see
+// `engine_capture()`. On the Uno this has to be the input capture pin ICP1.
+#ifdef _VARIANT_FEATHER_M4_
+#define PIN_EXPOSURE A2
+#else
+#define PIN_EXPOSURE 8
+#endif
+
+// Sync input and output, to phase-lock multiple trigger boxes. The sync output
+// follows channel 1. `PIN_SYNC_IN` must be interrupt capable.
+#ifdef _VARIANT_FEATHER_M4_
+#define PIN_SYNC_IN A3
+#define PIN_SYNC_OUT A1
+#else
+#define PIN_SYNC_IN 2
+#define PIN_SYNC_OUT 4
+#endif
+
+// Hardware start input, see `engine_set_trigger()`. Must be interrupt capable.
+#ifdef _VARIANT_FEATHER_M4_
+#define PIN_TRIGGER A4
+#else
+#define PIN_TRIGGER 3
+#endif
+
+static const uint8_t channel_pins[] = {CAM_PINS};
+#define N_CHANNELS (sizeof(channel_pins) / sizeof(channel_pins[0]))
+static_assert(N_CHANNELS <= 8, "At most 8 channels are supported");
+
+#ifdef _VARIANT_FEATHER_M4_
+#define TICKS_PER_USEC 48UL // Timer ticks per microsecond
+#else
+#define TICKS_PER_USEC 2UL // Timer ticks per microsecond
+#endif
+#define TICKS_PER_MSEC (TICKS_PER_USEC * 1000UL)
+
+// Fixed delay from `engine_fire()` to the start of the pulse train. Must cover
+// the time it takes to fire, which is bounded as the train got armed already.
+#define START_LEAD (100 * TICKS_PER_USEC)
+
+// Fixed delay from a rising edge on `PIN_TRIGGER` to the start of the pulse
+// train. Must cover the time it takes to service the edge, see
+// `engine_set_trigger()`.
+#ifdef _VARIANT_FEATHER_M4_
+#define TRIGGER_LEAD (10 * TICKS_PER_USEC)
+#else
+#define TRIGGER_LEAD (50 * TICKS_PER_USEC)
+#endif
+
+// Rising edges firing later than this w.r.t. their ideal time count as late,
+// see `HealthStats`
+#ifdef _VARIANT_FEATHER_M4_
+#define LATE_TICKS (1 * TICKS_PER_USEC)
+#else
+#define LATE_TICKS (5 * TICKS_PER_USEC)
+#endif
+
+// Capacity of the pulse event buffer, must be a power of two
+#ifdef _VARIANT_FEATHER_M4_
+#define EVENT_BUFFER_LEN 64
+#else
+#define EVENT_BUFFER_LEN 16
+#endif
+
+// A rising edge of the pulse train, as recorded by the ISR
+struct PulseEvent {
+  uint8_t outputs;    // Bit mask of the channels going high, bit 0 = channel 1
+  uint32_t pulse_idx; // Counter of the rising edges, starting at 1. Edges of
+                      // multiple channels on the same tick count once.
+  uint64_t t;         // Time since the start of the pulse train [ticks], as
+                      // latched from the counter right after the edge
+};
+
+// A rising edge on the exposure input, matched to the pulse that caused it
+struct ExposureEvent {
+  uint32_t pulse_idx; // Pulse index of the causing rising edge
+  uint32_t latency;   // Time from that rising edge to the exposure [ticks]
+};
+
+// Running statistics of the trigger-to-exposure latency [ticks]
+struct LatencyStats {
+  uint32_t n;         // Number of exposures matched to a pulse
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum;       // Sum of all latencies, for the mean
+  uint32_t missed;    // Pulses that got no exposure before the next pulse
+  uint32_t unmatched; // Exposures without a pulse to go with
+};
+
+// Timing health since power-up, kept up to date by the ISR at the cost of a few
+// cycles per edge
+struct HealthStats {
+  uint32_t pulses;   // Rising edges emitted, as counted by `pulse_idx`
+  uint32_t late_max; // Worst lateness of a rising edge w.r.t. its ideal time
+                     // [ticks]
+  uint32_t late_n;   // Rising edges later than `LATE_TICKS`
+  uint32_t dropped;  // Pulse and exposure events dropped
+  uint32_t overruns; // Rising edges that missed their slot, see `OverrunMode`
+  uint32_t skipped;  // Pulses or sequence steps skipped by `OVERRUN_SKIP`
+};
+
+// What to do when the scheduler has fallen behind, e.g. because interrupts got
+// disabled for too long. A rising edge has missed its slot once its whole
+// pulse width has passed, or for sequences, once the next step is due as well.
+enum OverrunMode : uint8_t {
+  OVERRUN_BURST, // Fire the missed edges back-to-back to catch up
+  OVERRUN_SKIP,  // Skip the missed pulses, resuming at the next aligned slot
+  OVERRUN_ABORT, // Stop the pulse train, see `engine_aborted()`
+};
+
+// How the pulse train responds to rising edges on `PIN_SYNC_IN`
+enum SyncMode : uint8_t {
+  SYNC_OFF,    // Ignore the sync input
+  SYNC_START,  // Start the pulse train at the first sync edge
+  SYNC_FOLLOW, // Idem, and re-phase it to every later sync edge
+  SYNC_CALIBRATE, // Timestamp the edges of a reference, see
+                  // `engine_calibration()`
+};
+
+// Limit of the drift correction [ppb]
+#define PPB_MAX 1000000L
+
+// How the pulse train responds to edges on `PIN_TRIGGER`
+enum TriggerMode : uint8_t {
+  TRIGGER_OFF,  // Ignore the trigger input
+  TRIGGER_EDGE, // Start the pulse train at a rising edge
+  TRIGGER_GATE, // Idem, and stop it at the falling edge
+};
+
+// A step of a pulse sequence. The outputs of the channels in `mask` are pulled
+// high, all others low, after which the next step follows `delta` ticks later.
+// This is also the layout of the steps as uploaded by the host.
+struct __attribute__((packed)) SequenceStep {
+  uint32_t delta; // Time until the next step [ticks]
+  uint8_t mask;   // Bit mask of the channels being high, bit 0 = channel 1
+};
+
+// Capacity of the sequence table
+#ifdef _VARIANT_FEATHER_M4_
+#define SEQUENCE_LEN 1024
+#else
+#define SEQUENCE_LEN 32
+#endif
+
+// Timing of a single output channel [ticks]
+struct ChannelTiming {
+  uint64_t period; // Pulse period, 0 to disable the channel
+  uint64_t offset; // Delay of the first rising edge w.r.t. the start
+  uint64_t width;  // Pulse width, must be smaller than `period`
+};
+
+// Configure the hardware timer and start the free-running counter. Call once
+// in `setup()`, after the output pins have been configured.
+void engine_begin();
+
+// Starting a pulse train takes two steps, so that the first edge does not
+// depend on how much there is to prepare:
+//   * Arm : Precompute the whole schedule, with the compare channel still off.
+//     Takes a variable time, depending on the channels or the sequence.
+//   * Fire: Shift the precomputed schedule to start `START_LEAD` after the
+//     call and program the compare channel for the first edge, which takes a
+//     bounded time. The first edge of each channel thus follows `START_LEAD`
+//     plus its own phase offset after the call, and each period, the first one
+//     included, gets timed by the same compare path.
+// Instead of `engine_fire()`, the sync or trigger input can fire the train, see
+// `engine_set_sync()` and `engine_set_trigger()`.
+
+// Arm the pulse train, with each channel firing its first rising edge after
+// its own phase offset. Channels stop firing once `T_meas` has elapsed.
+//   timing : Array of `N_CHANNELS` channel timings
+//   T_meas : Duration of the pulse train [ticks], 0 for endless
+void engine_arm(const ChannelTiming *timing, uint64_t T_meas);
+
+// Change the timing of the running pulse train without stopping it. Each
+// channel takes over its new period and width glitch-free at the end of its
+// current period, so that the outputs never see a runt period or a double
+// pulse, and `pulse_idx` and the timeline carry on. Phase offsets are kept, and
+// a channel that is off stays off until the next start. Returns false when no
+// periodic pulse train is running, leaving the timing to the next start.
+//   timing : Array of `N_CHANNELS` channel timings
+bool engine_update(const ChannelTiming *timing);
+
+// Arm the playback of a sequence of steps instead, from the table `steps` of
+// `n_steps` long. The table gets played `repeats` times, 0 for endless, or
+// until `T_meas` has elapsed. The table must stay untouched while playing.
+void engine_arm_sequence(const SequenceStep *steps, uint16_t n_steps,
+                         uint32_t repeats, uint64_t T_meas);
+
+#ifdef _VARIANT_FEATHER_M4_
+// Idem, but played back by DMA, without any CPU involvement per step and
+// without recording any pulse events, see `dma_playback.h`. Returns false when
+// the table does not qualify for DMA playback, in which case nothing gets
+// armed. Only `engine_fire()` fires it, the sync and trigger input do not apply.
+bool engine_arm_sequence_dma(const SequenceStep *steps, uint16_t n_steps,
+                             uint32_t repeats, uint64_t T_meas);
+#endif
+
+// Arm the periodic channels to be played by the hardware PWM instead, without
+// any CPU involvement per pulse, see `pwm_output.h`. Only a plain pulse train
+// qualifies, i.e. all channels that fire sharing the same period and width,
+// without phase offsets, drift correction or exposure input. Returns false
+// when it does not qualify, in which case nothing gets armed. Fires right away
+// instead of `START_LEAD` later, and only by `engine_fire()`, as the sync and
+// trigger input do not apply. Timing changes by `engine_update()` do not apply
+// either. The pulses do not get recorded as `PulseEvent`s, only counted.
+bool engine_arm_pwm(const ChannelTiming *timing, uint64_t T_meas);
+
+// Fire the armed pulse train, to start `START_LEAD` from now. Returns false
+// when it awaits the sync or trigger input instead, or when nothing is armed.
+bool engine_fire();
+
+// Stop the pulse train immediately and pull all outputs low
+void engine_stop();
+
+// Is the pulse train running? Will turn false by itself once `T_meas` has
+// elapsed.
+bool engine_running();
+
+// Is there no edge due within `ticks` from now? Meant to find a gap in which
+// interrupts can be disabled for a while without delaying any edge. An armed
+// pulse train is never quiet, as the input edge might come at any moment.
+// Under DMA playback it always is, apart from the end of `T_meas`.
+bool engine_quiet_for(uint32_t ticks);
+
+// Take out the oldest recorded pulse event. Returns false when there is none.
+bool engine_pop_event(PulseEvent &ev);
+
+// Are there pulse or exposure events waiting to be taken out?
+bool engine_events_pending();
+
+// Total number of pulse events dropped since the start of the pulse train,
+// because the event buffer was full
+uint32_t engine_dropped_events();
+
+// Enable or disable the timestamping of rising edges on `PIN_EXPOSURE`. Each
+// such edge gets matched to the latest rising edge of the outputs, yielding
+// the trigger-to-exposure latency of the camera.
+//   * Feather M4: Timestamped from the EIC interrupt, adding about 1 usec.
+//   * Uno: Latched by the input capture unit of Timer1, to the tick.
+// Starting a pulse train resets the statistics. Enabling gets refused, returning
+// false, while a pulse train of the hardware PWM is armed or playing: It has no
+// edges in software to match the exposures to, and on the Uno the PWM holds
+// Timer1, whose input capture would latch each pulse instead.
+bool engine_capture(bool f_enable);
+
+// Is the exposure input enabled?
+bool engine_capturing();
+
+// Take out the oldest exposure event. Returns false when there is none.
+// Dropped exposure events count towards `engine_dropped_events()`.
+bool engine_pop_exposure(ExposureEvent &ev);
+
+// Copy out the latency statistics since the start of the pulse train
+void engine_latency_stats(LatencyStats &stats);
+
+// Copy out the timing health since power-up. Not kept under DMA playback.
+void engine_health(HealthStats &stats);
+
+// Set the overrun policy, see `OverrunMode`. Does not apply to DMA playback.
+void engine_set_overrun(OverrunMode mode);
+OverrunMode engine_overrun();
+
+// Did the latest pulse train get stopped by `OVERRUN_ABORT`?
+bool engine_aborted();
+
+// Set the response to the sync input. Multiple boxes get phase-locked by
+// wiring the sync output of the master to the sync input of the slaves:
+//   * SYNC_START : Starting the pulse train merely arms it. The first sync
+//     edge then starts it, as if it got started at that very edge, so that its
+//     channel offsets count from the edge, e.g. from the first rising edge of
+//     channel 1 of the master.
+//   * SYNC_FOLLOW: Idem, after which each sync edge shifts the whole schedule
+//     so that the nearest rising edge of channel 1 coincides with it. The
+//     channel 1 periods of master and slave must hence be multiples of each
+//     other. Keeps the slave locked to the oscillator of the master. Does not
+//     apply to sequences.
+// The edge gets timestamped from its pin interrupt, so the slave lags by the
+// interrupt latency of about 1 usec (Uno: 4 usec). Does not apply to DMA
+// playback.
+void engine_set_sync(SyncMode mode);
+SyncMode engine_sync();
+
+// Set the response to the hardware start input. Starting the pulse train then
+// merely arms it, with everything precomputed:
+//   * TRIGGER_EDGE: A rising edge starts the train exactly `TRIGGER_LEAD` after
+//     the edge got timestamped, i.e. each channel fires its first rising edge
+//     at `TRIGGER_LEAD` plus its own phase offset after the input edge.
+//   * TRIGGER_GATE: Idem, and the falling edge stops it again.
+// The timestamp lags the input edge by the pin interrupt latency of about
+// 1 usec (Uno: 4 usec), with a jitter of a few CPU cycles. `engine_stop()`
+// still stops the train, armed or not. Does not apply to DMA playback.
+void engine_set_trigger(TriggerMode mode);
+TriggerMode engine_trigger();
+
+// Number of reference edges timestamped on `PIN_SYNC_IN` since setting
+// `SYNC_CALIBRATE`, with `span` the time between the first and the latest of
+// them [ticks]. Comparing `span` to the whole number of reference periods it
+// covers gives the drift of the board oscillator. Missed reference edges do
+// not matter.
+uint32_t engine_calibration(uint64_t &span);
+
+// Set the drift of the board oscillator w.r.t. the true time [ppb], positive
+// when it runs fast, to be corrected for from the next start onwards. The
+// channel periods and `T_meas` then get lengthened or shortened by the
+// fraction of a tick it takes, with the fractions accumulating per channel,
+// so that long runs stay phase-accurate. Sequences do not get corrected.
+void engine_set_ppb(int32_t ppb);
+int32_t engine_ppb();
+
+// Is the pulse train armed, awaiting to be fired?
+bool engine_armed();
+
+// Current time of the 64-bit timeline [ticks]
+uint64_t engine_now();
+
+#ifdef BENCH
+// Timing statistics of the scheduler, only built in by the `BENCH` build flag
+// of the benchmark environment, see `test/test_bench`
+#define BENCH_BINS 16 // Bins of the lateness histogram, the last one open-ended
+#define BENCH_BIN_TICKS (TICKS_PER_USEC >= 8 ? TICKS_PER_USEC / 8 : 1)
+
+struct BenchStats {
+  uint32_t late_hist[BENCH_BINS]; // Rising edges per bin of lateness
+  uint32_t late_max; // Worst lateness of a rising edge w.r.t. its ideal time
+  uint32_t isr_max;  // Worst delay of entering the ISR after a compare match
+  uint32_t isr_n;    // Number of compare matches serviced
+};
+
+// Copy out the statistics since the start of the pulse train [ticks]
+void engine_bench(BenchStats &stats);
+#endif
+
+#endif
@@ -0,0 +1,225 @@
+/*------------------------------------------------------------------------------
+PWM output
+
+Timer set-up of the hardware PWM on TCC1 (Feather M4) or Timer1 (Uno), see
+`pwm_output.h`.
+
+Dennis van Gils
+14-10-2026
+------------------------------------------------------------------------------*/
+
+#include "pwm_output.h"
+
+// Is `period` and `width` [ticks] a valid pulse train for the hardware?
+static bool valid_timing(uint32_t period, uint32_t width) {
+  return (period >= 2) && (period <= PWM_MAX_TICKS) && width &&
+         (width < period);
+}
+
+#ifdef _VARIANT_FEATHER_M4_
+
+#define EV_CH_COUNT 0 // Event channel counting the pulses
+#define EV_CH_STOP 1  // Event channel stopping TCC1 after the final pulse
+#define PMUX_TCC1 5   // Peripheral function F of pins PA16 to PA23
+
+static uint8_t pwm_mask = 0;       // Channels on the waveform outputs
+static bool f_initialized = false; // Are TCC1, TC0 and the events set up?
+
+// Index of the waveform output of TCC1 on `pin`, -1 when it has none
+static int8_t pin_wo(uint8_t pin) {
+  uint32_t bit = g_APinDescription[pin].ulPin;
+
+  if ((g_APinDescription[pin].ulPort != 0) || (bit < 16) || (bit > 23)) {
+    return -1;
+  }
+  return bit - 16;
+}
+
+// Hand `pin` over to TCC1, or back to the port
+static void pin_mux(uint8_t pin, bool f_tcc) {
+  uint32_t bit = g_APinDescription[pin].ulPin;
+  uint8_t pmux = PORT->Group[0].PMUX[bit >> 1].reg;
+
+  if (f_tcc) {
+    pmux = (bit & 1) ? (pmux & 0x0F) | PORT_PMUX_PMUXO(PMUX_TCC1)
+                     : (pmux & 0xF0) | PORT_PMUX_PMUXE(PMUX_TCC1);
+    PORT->Group[0].PMUX[bit >> 1].reg = pmux;
+    PORT->Group[0].PINCFG[bit].reg |= PORT_PINCFG_PMUXEN;
+  } else {
+    PORT->Group[0].PINCFG[bit].reg &= ~PORT_PINCFG_PMUXEN;
+  }
+}
+
+static void pwm_begin() {
+  // TC0 is the master of the 32-bit pair, TC1 its slave. Both share the same
+  // peripheral clock channel.
+  MCLK->APBBMASK.reg |= MCLK_APBBMASK_TCC1 | MCLK_APBBMASK_EVSYS;
+  MCLK->APBAMASK.reg |= MCLK_APBAMASK_TC0 | MCLK_APBAMASK_TC1;
+  GCLK->PCHCTRL[TCC1_GCLK_ID].reg = GCLK_PCHCTRL_GEN_GCLK1 | GCLK_PCHCTRL_CHEN;
+  while (!(GCLK->PCHCTRL[TCC1_GCLK_ID].reg & GCLK_PCHCTRL_CHEN)) {}
+  GCLK->PCHCTRL[TC0_GCLK_ID].reg = GCLK_PCHCTRL_GEN_GCLK1 | GCLK_PCHCTRL_CHEN;
+  while (!(GCLK->PCHCTRL[TC0_GCLK_ID].reg & GCLK_PCHCTRL_CHEN)) {}
+
+  // Asynchronous paths, as both users act on the events by themselves
+  EVSYS->Channel[EV_CH_COUNT].CHANNEL.reg =
+      EVSYS_CHANNEL_EVGEN(EVSYS_ID_GEN_TCC1_MC_0) |
+      EVSYS_CHANNEL_PATH_ASYNCHRONOUS;
+  EVSYS->USER[EVSYS_ID_USER_TC0_EVU].reg = EV_CH_COUNT + 1;
+  EVSYS->Channel[EV_CH_STOP].CHANNEL.reg =
+      EVSYS_CHANNEL_EVGEN(EVSYS_ID_GEN_TC0_MC_0) |
+      EVSYS_CHANNEL_PATH_ASYNCHRONOUS;
+  EVSYS->USER[EVSYS_ID_USER_TCC1_EV_1].reg = EV_CH_STOP + 1;
+
+  f_initialized = true;
+}
+
+bool pwm_output_load(uint8_t mask, uint32_t period, uint32_t width,
+                     uint32_t n_pulses) {
+  if (!mask || !valid_timing(period, width)) {
+    return false;
+  }
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    if ((mask & (1 << i)) && (pin_wo(channel_pins[i]) < 0)) {
+      return false;
+    }
+  }
+
+  if (!f_initialized) {
+    pwm_begin();
+  }
+  pwm_output_stop();
+  pwm_mask = mask;
+
+  // Each output is high while the count is below its compare value. WO[n]
+  // follows CC[n % 4], so all four get the same width.
+  TCC1->CTRLA.reg = TCC_CTRLA_SWRST;
+  while (TCC1->SYNCBUSY.bit.SWRST) {}
+  TCC1->CTRLA.reg = TCC_CTRLA_PRESCALER_DIV1;
+  TCC1->WAVE.reg = TCC_WAVE_WAVEGEN_NPWM;
+  TCC1->PER.reg = period - 1;
+  for (uint8_t cc = 0; cc < 4; cc++) {
+    TCC1->CC[cc].reg = width;
+  }
+  while (TCC1->SYNCBUSY.reg) {}
+  // Only event input 1 offers the STOP action
+  TCC1->EVCTRL.reg =
+      TCC_EVCTRL_MCEO0 |
+      (n_pulses ? TCC_EVCTRL_TCEI1 | TCC_EVCTRL_EVACT1_STOP : 0);
+
+  // The counter of the pulses only counts events, so it may run already
+  TC0->COUNT32.CTRLA.reg = TC_CTRLA_SWRST;
+  while (TC0->COUNT32.SYNCBUSY.bit.SWRST) {}
+  TC0->COUNT32.CTRLA.reg = TC_CTRLA_MODE_COUNT32 | TC_CTRLA_PRESCALER_DIV1;
+  TC0->COUNT32.WAVE.reg = TC_WAVE_WAVEGEN_NFRQ;
+  TC0->COUNT32.EVCTRL.reg = TC_EVCTRL_TCEI | TC_EVCTRL_EVACT_COUNT |
+                            (n_pulses ? TC_EVCTRL_MCEO0 : 0);
+  TC0->COUNT32.CC[0].reg = n_pulses;
+  while (TC0->COUNT32.SYNCBUSY.bit.CC0) {}
+  TC0->COUNT32.CTRLA.bit.ENABLE = 1;
+  while (TC0->COUNT32.SYNCBUSY.bit.ENABLE) {}
+
+  return true;
+}
+
+void pwm_output_start() {
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    if (pwm_mask & (1 << i)) {
+      pin_mux(channel_pins[i], true);
+    }
+  }
+
+  TCC1->CTRLA.bit.ENABLE = 1;
+  while (TCC1->SYNCBUSY.bit.ENABLE) {}
+}
+
+void pwm_output_stop() {
+  if (!f_initialized) {
+    return;
+  }
+
+  TCC1->CTRLA.bit.ENABLE = 0;
+  while (TCC1->SYNCBUSY.bit.ENABLE) {}
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    if (pwm_mask & (1 << i)) {
+      pin_mux(channel_pins[i], false);
+    }
+  }
+  pwm_mask = 0;
+}
+
+bool pwm_output_running() {
+  return TCC1->CTRLA.bit.ENABLE && !TCC1->STATUS.bit.STOP;
+}
+
+uint32_t pwm_output_pulses() {
+  TC0->COUNT32.CTRLBSET.reg = TC_CTRLBSET_CMD_READSYNC;
+  while (TC0->COUNT32.CTRLBSET.bit.CMD) {}
+  return TC0->COUNT32.COUNT.reg;
+}
+
+#else
+
+static uint16_t pwm_top = 0;  // TOP of Timer1 [ticks - 1]
+static uint16_t pwm_ocr = 0;  // Compare value of the outputs [ticks - 1]
+static uint8_t pwm_com = 0;   // Compare output modes of the outputs used
+
+bool pwm_output_load(uint8_t mask, uint32_t period, uint32_t width,
+                     uint32_t n_pulses) {
+  uint8_t com = 0;
+
+  if (!mask || n_pulses || !valid_timing(period, width)) {
+    return false;
+  }
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    if (!(mask & (1 << i))) {
+      continue;
+    }
+    if (channel_pins[i] == 9) {
+      com |= _BV(COM1A1); // OC1A: Set at BOTTOM, cleared on compare match
+    } else if (channel_pins[i] == 10) {
+      com |= _BV(COM1B1); // OC1B: Idem
+    } else {
+      return false;
+    }
+  }
+
+  pwm_top = period - 1;
+  pwm_ocr = width - 1;
+  pwm_com = com;
+  return true;
+}
+
+void pwm_output_start() {
+  TCCR1B = 0; // Stop the clock
+  TCCR1A = pwm_com | _BV(WGM11);
+  ICR1 = pwm_top;
+  OCR1A = pwm_ocr; // High for OCR1x + 1 ticks
+  OCR1B = pwm_ocr;
+  TCNT1 = pwm_top; // Wraps to BOTTOM at the first tick, raising the outputs
+  TIFR1 = _BV(TOV1) | _BV(OCF1A) | _BV(OCF1B) | _BV(ICF1);
+  // The overflows count the pulses, while the compare matches end them
+  TIMSK1 = (TIMSK1 & ~(_BV(OCIE1A) | _BV(OCIE1B))) | _BV(TOIE1);
+  TCCR1B = _BV(WGM13) | _BV(WGM12) | _BV(CS11);
+}
+
+void pwm_output_stop() {
+  TCCR1B = 0;
+  TCCR1A = 0; // Outputs back to the port
+}
+
+uint64_t pwm_output_elapsed(uint32_t &n_ovf) {
+  uint16_t count = TCNT1;
+
+  // An overflow might have occurred that has not yet been serviced by its ISR
+  if ((TIFR1 & _BV(TOV1)) && (count < (pwm_top >> 1))) {
+    n_ovf++;
+  }
+
+  // The first overflow follows the start by a single tick, see above
+  if (n_ovf == 0) {
+    return 0;
+  }
+  return 1 + (uint64_t)(n_ovf - 1) * ((uint32_t)pwm_top + 1) + count;
+}
+
+#endif
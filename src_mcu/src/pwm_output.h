@@ -0,0 +1,86 @@
+/*------------------------------------------------------------------------------
+PWM output
+
+Plays a plain periodic pulse train, i.e. all channels sharing the same period
+and pulse width without phase offsets, by the waveform output of a hardware
+timer straight on the output pins. Apart from starting and stopping it, the CPU
+is not involved per pulse at all, so that the pulses are free of any software
+jitter and can follow each other within a few usec.
+
+  * Adafruit Feather M4 Express:
+    TCC1 in single-slope PWM, clocked by GCLK1 at 48 MHz, on its waveform
+    outputs WO[0] to WO[7], being pins PA16 to PA23, i.e. D05, D06, D09 to D13
+    and SCK. Each output goes high at the start of the period and low at the
+    compare match. The event system feeds the compare matches of CC0, i.e. the
+    end of each pulse, into TC0 and TC1 paired into a 32-bit counter, which
+    counts the pulses. For a finite number of pulses the compare match of this
+    counter stops TCC1 right after the falling edge of the final pulse, again
+    over the event system, so that the train ends without a runt pulse.
+    Periods up to 2^24 ticks, i.e. 349 msec.
+  * Arduino Uno:
+    Timer1 in fast PWM mode 14, with ICR1 as TOP, on its outputs OC1A and OC1B,
+    being pins D09 and D10, at the same prescaler of 8 as the timeline. Timer0
+    runs `millis()`, so PWM is not possible on the default pins D05 and D06:
+    Build with `-D CAM_PINS=9,10` instead. Timer1 gets taken over from the
+    timeline while playing, and the overflow interrupt of the pulse engine
+    then counts the pulses apart from the timeline. The time the PWM played
+    follows from that count and the counter, by `pwm_output_elapsed()`, from
+    which the timeline carries on afterwards. Periods up to 2^16 ticks, i.e.
+    32.7 msec. The overflow interrupt costs about 3 usec per pulse, hence the
+    period has to stay well above that.
+
+Restrictions:
+  * The on-board LED and the sync output do not follow channel 1.
+  * No drift correction, no exposure input and no change of the timing while
+    running.
+  * No `PulseEvent`s get recorded, only the number of pulses.
+
+Takes TCC1, TC0, TC1 and event channels 0 and 1 (Feather M4), which are hence
+off limits for other libraries, e.g. `tone()`.
+
+Dennis van Gils
+14-10-2026
+------------------------------------------------------------------------------*/
+
+#ifndef PWM_OUTPUT_H
+#define PWM_OUTPUT_H
+
+#include <Arduino.h>
+
+#include "pulse_engine.h"
+
+// Longest period [ticks]
+#ifdef _VARIANT_FEATHER_M4_
+#define PWM_MAX_TICKS (1UL << 24)
+#else
+#define PWM_MAX_TICKS (1UL << 16)
+#endif
+
+// Prepare for pulses of `width` ticks every `period` ticks on the pins of the
+// channels in the bit mask `mask`. Returns false when the pins or the timing do
+// not qualify, in which case nothing changes.
+//   n_pulses: Pulses to fire, 0 for endless. Not supported by the Uno.
+bool pwm_output_load(uint8_t mask, uint32_t period, uint32_t width,
+                     uint32_t n_pulses);
+
+// Start the loaded pulse train, with the first rising edge right away
+void pwm_output_start();
+
+// Stop the pulse train and hand the pins back as digital outputs, low
+void pwm_output_stop();
+
+#ifdef _VARIANT_FEATHER_M4_
+// Is the pulse train playing? Turns false after the final pulse.
+bool pwm_output_running();
+
+// Number of pulses fired so far
+uint32_t pwm_output_pulses();
+#else
+// Ticks since `pwm_output_start()`, given the number of overflows of Timer1
+// `n_ovf` serviced so far, i.e. the pulses started. An overflow that is still
+// pending gets added to `n_ovf`. Call with interrupts disabled, before
+// `pwm_output_stop()`.
+uint64_t pwm_output_elapsed(uint32_t &n_ovf);
+#endif
+
+#endif
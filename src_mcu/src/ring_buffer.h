@@ -0,0 +1,98 @@
+/*------------------------------------------------------------------------------
+Ring buffer
+
+Lock-free single-producer/single-consumer FIFO. Meant to pass data from an ISR
+(the producer) to the main loop (the consumer) without disabling interrupts or
+ever blocking the ISR:
+
+  * Only the producer writes `_head` and only the consumer writes `_tail`.
+  * Both indices are `uint8_t`, so reading them is atomic on the AVR as well.
+  * The indices run freely and wrap around at 256, which is why the capacity
+    `N` must be a power of two of at most 128.
+
+When the buffer is full, `push()` discards the new item and increments a
+dropped-item counter instead of waiting for the consumer.
+
+Dennis van Gils
+14-10-2026
+------------------------------------------------------------------------------*/
+
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <Arduino.h>
+
+// Prevent the compiler from reordering memory accesses across this point
+#define COMPILER_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+template <typename T, uint8_t N> class RingBuffer {
+  static_assert((N & (N - 1)) == 0, "Capacity must be a power of two");
+  static_assert(N <= 128, "Capacity must be at most 128");
+
+public:
+  // Producer: Append an item. Returns false when the buffer is full, in which
+  // case the item gets dropped.
+  bool push(const T &item) {
+    uint8_t head = _head;
+
+    if ((uint8_t)(head - _tail) >= N) {
+      _dropped++;
+      return false;
+    }
+
+    _buf[head & (N - 1)] = item;
+    COMPILER_BARRIER(); // Item must be stored before it gets published
+    _head = head + 1;
+    return true;
+  }
+
+  // Consumer: Take out the oldest item. Returns false when the buffer is empty.
+  bool pop(T &item) {
+    uint8_t tail = _tail;
+
+    if (tail == _head) {
+      return false;
+    }
+
+    COMPILER_BARRIER(); // Item must not be read before it got published
+    item = _buf[tail & (N - 1)];
+    COMPILER_BARRIER(); // Item must be read before its slot gets released
+    _tail = tail + 1;
+    return true;
+  }
+
+  // Consumer: Number of items waiting
+  uint8_t count() const { return (uint8_t)(_head - _tail); }
+
+  // Total number of items dropped because the buffer was full. Only the
+  // producer writes it, so the consumer should keep track of what it already
+  // has reported.
+  uint32_t dropped() const {
+#ifdef __AVR__
+    uint32_t n;
+
+    noInterrupts(); // 32-bit read is not atomic on the AVR
+    n = _dropped;
+    interrupts();
+
+    return n;
+#else
+    return _dropped;
+#endif
+  }
+
+  // Empty the buffer and reset the dropped-item counter. Only to be used when
+  // the producer is known to be inactive.
+  void reset() {
+    _head = _tail = 0;
+    _dropped = 0;
+  }
+
+private:
+  T _buf[N];
+  volatile uint8_t _head = 0;
+  volatile uint8_t _tail = 0;
+  volatile uint32_t _dropped = 0;
+};
+
+#endif
@@ -0,0 +1,97 @@
+/*------------------------------------------------------------------------------
+Serial output
+
+Text FIFO and record queue feeding the serial port, see `serial_out.h`.
+
+Dennis van Gils
+14-10-2026
+------------------------------------------------------------------------------*/
+
+#include "serial_out.h"
+
+size_t SerialOut::write(uint8_t c) {
+  if (pending() >= OUT_BUF_LEN - 1) {
+    _drain(_port.availableForWrite());
+  }
+  if ((pending() >= OUT_BUF_LEN) ||
+      ((pending() == OUT_BUF_LEN - 1) && (c != '\n'))) {
+    _nDropped++;
+    return 0;
+  }
+
+  _buf[_head & (OUT_BUF_LEN - 1)] = c;
+  _head++;
+  return 1;
+}
+
+size_t SerialOut::write(const uint8_t *buffer, size_t size) {
+  size_t n = 0; // Number of bytes queued
+
+  for (size_t i = 0; i < size; i++) {
+    n += write(buffer[i]);
+  }
+  return n;
+}
+
+void SerialOut::writeRecord(const uint8_t *rec, uint8_t len) {
+  uint8_t idx;
+
+  if (len > OUT_RECORD_LEN) {
+    len = OUT_RECORD_LEN;
+  }
+  if (_nRecords >= OUT_RECORDS) {
+    _sendRecords(false);
+  }
+  if (_nRecords >= OUT_RECORDS) {
+    _nDropped += len;
+    return;
+  }
+
+  idx = (_recordTail + _nRecords) % OUT_RECORDS;
+  memcpy(_records[idx], rec, len);
+  _recordLen[idx] = len;
+  _nRecords++;
+}
+
+int SerialOut::availableForWrite() { return OUT_BUF_LEN - pending(); }
+
+void SerialOut::service() {
+  _sendRecords(false);
+  if (pending()) {
+    _drain(_port.availableForWrite());
+    _sendRecords(false);
+  }
+}
+
+void SerialOut::flush() {
+  while (pending()) {
+    _drain(OUT_PACKET_LEN);
+  }
+  _sendRecords(true);
+}
+
+void SerialOut::_drain(int room) {
+  uint8_t packet[OUT_PACKET_LEN];
+  uint8_t n; // Number of bytes in `packet`
+
+  while (pending() && (room > 0)) {
+    n = 0;
+    while ((n < OUT_PACKET_LEN) && (n < room) && (_tail != _head)) {
+      packet[n++] = _buf[_tail & (OUT_BUF_LEN - 1)];
+      _tail++;
+    }
+    _fLineStart = (packet[n - 1] == '\n');
+    _port.write(packet, n);
+    room -= n;
+  }
+}
+
+void SerialOut::_sendRecords(bool f_wait) {
+  while (_nRecords &&
+         (f_wait || (_fLineStart && (_port.availableForWrite() >=
+                                     _recordLen[_recordTail])))) {
+    _port.write(_records[_recordTail], _recordLen[_recordTail]);
+    _recordTail = (_recordTail + 1) % OUT_RECORDS;
+    _nRecords--;
+  }
+}
@@ -0,0 +1,118 @@
+/*------------------------------------------------------------------------------
+Serial output
+
+Non-blocking, batched output to the serial port, shared by all reporting. The
+text gets printed into a FIFO in SRAM instead of straight to the port, and
+`service()`, called from the main loop, drains it only as far as the transmit
+buffer of the port has room, so that printing never blocks the loop:
+
+  * The FIFO gets sent in packets of up to `OUT_PACKET_LEN` bytes, being the
+    maximum packet size of the native USB of the Feather M4, so that it has to
+    send as few packets as possible.
+  * The pulse reports take priority over the text: The main loop writes them
+    straight to the port before servicing the FIFO, but only while
+    `atLineStart()`, so that they never end up in the middle of a text line.
+  * The FIFO holds `OUT_BUF_LEN` bytes, which must be a power of two. It can
+    be set as a build flag in `platformio.ini`. Replies longer than the FIFO
+    have to be printed in parts as it has room, like the help text. Once the
+    FIFO is full, printing first hands the port what its transmit buffer
+    takes right away. What still does not fit gets dropped and counted by
+    `getDropped()`, instead of waiting for the port. The last byte of the
+    FIFO is kept for a '\n', so that a line cut off still gets ended.
+  * Binary records, i.e. the acknowledgements of the binary commands, get
+    queued apart from the text by `writeRecord()`, as they may hold any byte,
+    '\n' included, which would throw off `atLineStart()`. Like the pulse
+    reports, `service()` sends them in between the text lines. The queue
+    holds `OUT_RECORDS` records, after which one more gets dropped, again
+    counted by `getDropped()`.
+
+Dennis van Gils
+14-10-2026
+------------------------------------------------------------------------------*/
+
+#ifndef SERIAL_OUT_H
+#define SERIAL_OUT_H
+
+#include <Arduino.h>
+
+#ifndef OUT_BUF_LEN
+#ifdef _VARIANT_FEATHER_M4_
+#define OUT_BUF_LEN 1024
+#else
+#define OUT_BUF_LEN 128
+#endif
+#endif
+
+#ifndef OUT_RECORDS
+#ifdef _VARIANT_FEATHER_M4_
+#define OUT_RECORDS 8
+#else
+#define OUT_RECORDS 2
+#endif
+#endif
+
+#define OUT_PACKET_LEN 64
+#define OUT_RECORD_LEN 17 // Longest binary record, see `TELEMETRY_RECORD_LEN`
+
+class SerialOut : public Print {
+  static_assert((OUT_BUF_LEN & (OUT_BUF_LEN - 1)) == 0,
+                "OUT_BUF_LEN must be a power of two");
+  static_assert(OUT_BUF_LEN <= 32768, "OUT_BUF_LEN must be at most 32768");
+
+public:
+  SerialOut(Stream &port) : _port(port) {}
+
+  // Queue the bytes in the FIFO. Drops those that do not fit.
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+
+  // Free space in the FIFO
+  int availableForWrite() override;
+
+  // Queue the binary record `rec` of `len` bytes, at most `OUT_RECORD_LEN`.
+  // Drops it when the queue is full.
+  void writeRecord(const uint8_t *rec, uint8_t len);
+
+  // Number of bytes waiting in the FIFO
+  uint16_t pending() const { return _head - _tail; }
+
+  // Number of binary records waiting in the queue
+  uint8_t pendingRecords() const { return _nRecords; }
+
+  // Has the port been sent a complete line, i.e. may the pulse reports go in
+  // between?
+  bool atLineStart() const { return _fLineStart; }
+
+  // Send as much of the FIFO and the queued records as the transmit buffer of
+  // the port has room for
+  void service();
+
+  // Send the whole FIFO and all queued records, waiting for the port where
+  // needed
+  void flush() override;
+
+  // Number of bytes dropped, because the FIFO or the record queue was full
+  uint32_t getDropped() const { return _nDropped; }
+
+private:
+  // Send up to `room` bytes of the FIFO to the port, in packets
+  void _drain(int room);
+
+  // Send the queued records, as long as the port has room for them at a line
+  // boundary, or all of them right away when `f_wait`
+  void _sendRecords(bool f_wait);
+
+  Stream &_port;
+  uint8_t _buf[OUT_BUF_LEN];
+  uint16_t _head = 0; // Runs freely, wrapping around at 65536
+  uint16_t _tail = 0; // Runs freely, wrapping around at 65536
+  bool _fLineStart = true;
+  uint8_t _records[OUT_RECORDS][OUT_RECORD_LEN];
+  uint8_t _recordLen[OUT_RECORDS];
+  uint8_t _recordTail = 0; // Oldest record in the queue
+  uint8_t _nRecords = 0;   // Number of records in the queue
+  uint32_t _nDropped = 0;
+};
+
+#endif
@@ -0,0 +1,225 @@
+/*------------------------------------------------------------------------------
+Settings store
+
+Slot rotation and CRC checks of the settings in EEPROM (Uno) or flash
+(Feather M4), see `settings_store.h`.
+
+Dennis van Gils
+14-10-2026
+------------------------------------------------------------------------------*/
+
+#include "settings_store.h"
+
+#ifndef _VARIANT_FEATHER_M4_
+#include <EEPROM.h>
+#endif
+
+#define STORE_MAGIC 0x5E77
+
+struct SlotHeader {
+  uint16_t magic;
+  uint16_t count; // Save counter
+  uint16_t len;   // Length of the block following the header
+  uint8_t crc;    // CRC-8 over the block
+} __attribute__((packed));
+
+// CRC-8, polynomial 0x07
+static uint8_t crc8_update(uint8_t crc, uint8_t c) {
+  crc ^= c;
+  for (uint8_t bit = 0; bit < 8; bit++) {
+    crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+  }
+  return crc;
+}
+
+/*------------------------------------------------------------------------------
+  Memory
+------------------------------------------------------------------------------*/
+
+#ifdef _VARIANT_FEATHER_M4_
+
+#define STORE_SLOTS 4
+#define SLOT_SIZE NVMCTRL_BLOCK_SIZE // The unit of erasing
+
+// The storage area in flash. Volatile, as it gets changed behind the
+// compiler's back.
+static const volatile uint8_t area[STORE_SLOTS * SLOT_SIZE]
+    __attribute__((aligned(NVMCTRL_BLOCK_SIZE))) = {0};
+
+static inline uint16_t slot_size(uint16_t len) { return SLOT_SIZE; }
+
+static void area_read(uint32_t addr, void *dest, uint16_t len) {
+  uint8_t *p = (uint8_t *)dest;
+
+  for (uint16_t i = 0; i < len; i++) {
+    p[i] = area[addr + i];
+  }
+}
+
+static void nvm_command(uint16_t cmd) {
+  NVMCTRL->CTRLB.reg = NVMCTRL_CTRLB_CMDEX_KEY | cmd;
+  while (!NVMCTRL->INTFLAG.bit.DONE) {}
+  NVMCTRL->INTFLAG.reg = NVMCTRL_INTFLAG_DONE;
+}
+
+// Erase the slot starting at `addr` and program the header `hdr` followed by
+// the block `data` of `len` bytes into it. The page buffer only takes 32-bit
+// writes.
+static void slot_write(uint32_t addr, const SlotHeader &hdr, const uint8_t *data,
+                       uint16_t len) {
+  const uint8_t *head = (const uint8_t *)&hdr;
+  uint16_t n = sizeof(hdr) + len;
+  volatile uint32_t *dest = (volatile uint32_t *)&area[addr];
+  bool f_cache = CMCC->SR.bit.CSTS;
+
+  CMCC->CTRL.bit.CEN = 0; // Keep stale flash contents out of the cache
+  while (CMCC->SR.bit.CSTS) {}
+  while (!NVMCTRL->STATUS.bit.READY) {}
+  NVMCTRL->CTRLA.reg = (NVMCTRL->CTRLA.reg & ~NVMCTRL_CTRLA_WMODE_Msk) |
+                       NVMCTRL_CTRLA_WMODE_MAN;
+
+  NVMCTRL->ADDR.reg = (uint32_t)(uintptr_t)dest;
+  nvm_command(NVMCTRL_CTRLB_CMD_EB);
+
+  for (uint16_t page = 0; page < n; page += NVMCTRL_PAGE_SIZE) {
+    nvm_command(NVMCTRL_CTRLB_CMD_PBC);
+    for (uint16_t i = page; (i < page + NVMCTRL_PAGE_SIZE) && (i < n); i += 4) {
+      uint32_t word = 0xFFFFFFFF; // Erased state
+
+      for (uint8_t j = 0; (j < 4) && (i + j < n); j++) {
+        uint16_t k = i + j;
+        uint8_t c = (k < sizeof(hdr)) ? head[k] : data[k - sizeof(hdr)];
+
+        word = (word & ~(0xFFUL << (8 * j))) | ((uint32_t)c << (8 * j));
+      }
+      *dest++ = word;
+    }
+    nvm_command(NVMCTRL_CTRLB_CMD_WP);
+  }
+
+  CMCC->MAINT0.reg = CMCC_MAINT0_INVALL;
+  CMCC->CTRL.bit.CEN = f_cache;
+}
+
+#else
+
+// The stored baud rate sits at the start of the EEPROM, see `main.cpp`
+#define AREA_START 8
+#define AREA_SIZE (E2END + 1 - AREA_START)
+
+static inline uint16_t slot_size(uint16_t len) {
+  return sizeof(SlotHeader) + len;
+}
+
+static void area_read(uint32_t addr, void *dest, uint16_t len) {
+  uint8_t *p = (uint8_t *)dest;
+
+  for (uint16_t i = 0; i < len; i++) {
+    p[i] = EEPROM.read(AREA_START + addr + i);
+  }
+}
+
+static void eeprom_write(uint32_t addr, const uint8_t *src, uint16_t len) {
+  for (uint16_t i = 0; i < len; i++) {
+    EEPROM.update(AREA_START + addr + i, src[i]);
+  }
+}
+
+// Write the header `hdr` followed by the block `data` of `len` bytes into the
+// slot at `addr`. The block goes first, with the header invalidated, so that
+// an interrupted save leaves the slot invalid.
+static void slot_write(uint32_t addr, const SlotHeader &hdr, const uint8_t *data,
+                       uint16_t len) {
+  SlotHeader invalid = hdr;
+
+  invalid.magic = 0;
+  eeprom_write(addr, (const uint8_t *)&invalid, sizeof(invalid));
+  eeprom_write(addr + sizeof(hdr), data, len);
+  eeprom_write(addr, (const uint8_t *)&hdr, sizeof(hdr));
+}
+
+#endif
+
+/*------------------------------------------------------------------------------
+  Slots
+------------------------------------------------------------------------------*/
+
+static uint16_t n_slots(uint16_t len) {
+#ifdef _VARIANT_FEATHER_M4_
+  return (sizeof(SlotHeader) + len <= SLOT_SIZE) ? STORE_SLOTS : 0;
+#else
+  return AREA_SIZE / slot_size(len);
+#endif
+}
+
+// CRC-8 over the stored block of the slot at `addr`
+static uint8_t slot_crc(uint32_t addr, uint16_t len) {
+  uint8_t crc = 0;
+  uint8_t c;
+
+  for (uint16_t i = 0; i < len; i++) {
+    area_read(addr + sizeof(SlotHeader) + i, &c, 1);
+    crc = crc8_update(crc, c);
+  }
+  return crc;
+}
+
+// Find the slot holding the latest valid block of `len` bytes. Returns -1 when
+// there is none.
+static int16_t latest_slot(uint16_t len, uint16_t &count) {
+  int16_t latest = -1;
+  SlotHeader hdr;
+
+  for (uint16_t i = 0; i < n_slots(len); i++) {
+    uint32_t addr = (uint32_t)i * slot_size(len);
+
+    area_read(addr, &hdr, sizeof(hdr));
+    if ((hdr.magic != STORE_MAGIC) || (hdr.len != len)) {
+      continue;
+    }
+    // The save counter wraps around, hence the signed difference
+    if ((latest >= 0) && ((int16_t)(hdr.count - count) <= 0)) {
+      continue;
+    }
+    if (hdr.crc != slot_crc(addr, len)) {
+      continue;
+    }
+    latest = i;
+    count = hdr.count;
+  }
+  return latest;
+}
+
+bool store_load(void *data, uint16_t len) {
+  uint16_t count;
+  int16_t slot = latest_slot(len, count);
+
+  if (slot < 0) {
+    return false;
+  }
+  area_read((uint32_t)slot * slot_size(len) + sizeof(SlotHeader), data, len);
+  return true;
+}
+
+bool store_save(const void *data, uint16_t len) {
+  uint16_t count = 0;
+  int16_t slot;
+  uint8_t crc = 0;
+  const uint8_t *p = (const uint8_t *)data;
+
+  if (n_slots(len) == 0) {
+    return false;
+  }
+
+  slot = latest_slot(len, count);
+  slot = (slot + 1) % n_slots(len);
+  count++;
+
+  for (uint16_t i = 0; i < len; i++) {
+    crc = crc8_update(crc, p[i]);
+  }
+  SlotHeader hdr = {STORE_MAGIC, count, len, crc};
+
+  slot_write((uint32_t)slot * slot_size(len), hdr, p, len);
+  return true;
+}
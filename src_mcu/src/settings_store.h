@@ -0,0 +1,45 @@
+/*------------------------------------------------------------------------------
+Settings store
+
+Keeps a block of settings in non-volatile memory, so that they survive a power
+cycle. The storage area gets divided into slots, each holding a complete copy
+of the block behind a small header:
+
+  * A magic number, to recognize that the slot got written by us
+  * A save counter, incremented with each save, to find the latest slot
+  * The length of the block, so that a block of another firmware version with
+    another layout gets rejected instead of misread
+  * A CRC-8 over the block, so that a save interrupted by a power loss gets
+    rejected as well, falling back to the previous save
+
+Each save goes to the slot after the latest one, round-robin, which spreads the
+wear over all slots.
+
+  * Adafruit Feather M4 Express:
+    The SAMD51 has no real EEPROM, so the slots are blocks of 8 kB of flash,
+    reserved by a const array. Each save erases and programs a block through
+    NVMCTRL, stalling the CPU for tens of msecs. Flashing new firmware erases
+    the stored settings.
+  * Arduino Uno:
+    The slots are packed into the EEPROM above the stored baud rate. The
+    EEPROM library only writes the bytes that changed.
+
+Dennis van Gils
+14-10-2026
+------------------------------------------------------------------------------*/
+
+#ifndef SETTINGS_STORE_H
+#define SETTINGS_STORE_H
+
+#include <Arduino.h>
+
+// Load the latest valid copy of the settings block of `len` bytes into `data`.
+// Returns false when there is none, leaving `data` untouched.
+bool store_load(void *data, uint16_t len);
+
+// Save the settings block of `len` bytes from `data` into the next slot.
+// Returns false when the block does not fit a slot. Must not be called while
+// the pulse train is running, as it stalls the CPU on the Feather M4.
+bool store_save(const void *data, uint16_t len);
+
+#endif
@@ -0,0 +1,78 @@
+/*------------------------------------------------------------------------------
+Telemetry
+
+Compact binary framing of the pulse events, as an alternative to the default
+text lines of the form "# 12 @ t = 00:00:01.000000". Each event is sent as a
+fixed-size record of `TELEMETRY_RECORD_LEN` bytes, all multi-byte fields being
+little-endian:
+
+    offset  size  field
+    ------  ----  -----------------------------------------------------------
+         0     1  Sync byte `TELEMETRY_SYNC` (0xA5)
+         1     1  Record type, see `TelemetryType`
+         2     1  Bit mask of the channels going high, bit 0 being channel 1
+         3     1  Sequence number, incremented with every record sent
+         4     4  uint32: Pulse index, or the count for a `TELEMETRY_DROPPED`
+         8     8  uint64: Time since the start of the pulse train [ticks],
+                  latched from the hardware counter at the edge, 0 for a
+                  `TELEMETRY_DROPPED`, or the trigger-to-exposure latency
+                  [ticks] for a `TELEMETRY_LATENCY`
+        16     1  CRC-8 over bytes 0 to 15, polynomial 0x07, initial value 0
+
+The tick rate is reported by the `?` command. A gap in the sequence numbers
+tells the host that records got lost on the link, whereas a failing CRC or a
+missing sync byte tells it to resynchronize. Replies to commands are still sent
+as text lines and never contain the sync byte.
+
+Dennis van Gils
+14-10-2026
+------------------------------------------------------------------------------*/
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+
+#define TELEMETRY_SYNC 0xA5
+#define TELEMETRY_RECORD_LEN 17
+
+enum TelemetryType : uint8_t {
+  TELEMETRY_PULSE = 'P',   // Rising edge
+  TELEMETRY_DROPPED = 'D', // Pulse events dropped, `pulse_idx` holds the count
+  TELEMETRY_LATENCY = 'L', // Exposure of the camera in response to a pulse
+  TELEMETRY_ACK = 'A',     // Reply to a binary command frame, with the channel
+                           // mask holding the command id and `pulse_idx` the
+                           // status, see `FrameStatus` in `main.cpp`
+};
+
+// CRC-8 with polynomial 0x07 and initial value 0
+inline uint8_t crc8(const uint8_t *data, uint8_t len) {
+  uint8_t crc = 0;
+
+  while (len--) {
+    crc ^= *data++;
+    for (uint8_t i = 0; i < 8; i++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+    }
+  }
+
+  return crc;
+}
+
+// Pack a record into `buf`, which must hold `TELEMETRY_RECORD_LEN` bytes
+inline void telemetry_pack(uint8_t *buf, TelemetryType type, uint8_t outputs,
+                           uint8_t seq, uint32_t pulse_idx, uint64_t t) {
+  buf[0] = TELEMETRY_SYNC;
+  buf[1] = type;
+  buf[2] = outputs;
+  buf[3] = seq;
+  for (uint8_t i = 0; i < 4; i++) {
+    buf[4 + i] = (uint8_t)(pulse_idx >> (8 * i));
+  }
+  for (uint8_t i = 0; i < 8; i++) {
+    buf[8 + i] = (uint8_t)(t >> (8 * i));
+  }
+  buf[16] = crc8(buf, 16);
+}
+
+#endif
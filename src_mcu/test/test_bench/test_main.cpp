@@ -0,0 +1,209 @@
+/*------------------------------------------------------------------------------
+Benchmark of the timing of the scheduler
+
+Runs on the Adafruit Feather M4 Express itself, by
+
+  pio test -e bench_feather_m4
+
+It plays a pulse train on all channels, with edges of different channels
+coinciding every now and then, and reports:
+
+  * The histogram of how late the rising edges fire w.r.t. their ideal time
+    `t_start + k * DT`, and the worst case
+  * The worst delay of entering the ISR after a compare match, which must stay
+    within the busy-wait margin `SPIN_TICKS` of the pulse engine
+  * The worst gap between two passes of the main loop, i.e. how long the ISR
+    can keep the main loop waiting
+  * The cost of `DvG_SerialCommand::available()` per incoming byte
+  * The time `neo.show()` keeps the interrupts disabled
+
+Each result gets printed as a line `BENCH <name> = <value> <unit>`, so that
+repeated runs can be compared, and gets checked against a limit to catch
+timing regressions. The time is measured by the DWT cycle counter of the
+Cortex-M4, at `F_CPU`, or by the ticks of the pulse engine.
+
+Dennis van Gils
+14-10-2026
+------------------------------------------------------------------------------*/
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "Adafruit_NeoPixel.h"
+#include "DvG_SerialCommand.h"
+#include "pulse_engine.h"
+
+// Limits to catch regressions
+#define LATE_MAX (2 * TICKS_PER_USEC)     // Lateness of an edge [ticks]
+#define ISR_MAX (2 * TICKS_PER_USEC)      // Delay of the ISR, `SPIN_TICKS`
+#define LOOP_MAX_USEC 50                  // Gap of the main loop [usec]
+#define AVAILABLE_MAX_CYCLES_PER_BYTE 200 // Cost of parsing [CPU cycles]
+#define NEO_MAX_USEC 100                  // Blackout of `neo.show()` [usec]
+
+#define BENCH_T_MEAS 2000 // Duration of the pulse train [msec]
+
+#define CYCLES_PER_USEC (F_CPU / 1000000)
+
+static BenchStats stats;
+static uint32_t loop_max = 0; // Worst gap of the main loop [CPU cycles]
+static uint32_t n_events = 0; // Pulse events taken out
+
+// Serves a fixed block of bytes as the incoming serial data
+class MemStream : public Stream {
+public:
+  MemStream(const char *data) : _data(data), _len(strlen(data)), _pos(0) {}
+
+  int available() override { return _len - _pos; }
+  int read() override { return (_pos < _len) ? _data[_pos++] : -1; }
+  int peek() override { return (_pos < _len) ? _data[_pos] : -1; }
+  size_t write(uint8_t c) override { return 1; }
+  void flush() override {}
+
+private:
+  const char *_data;
+  size_t _len;
+  size_t _pos;
+};
+
+static void cycles_begin() {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+static void report(const char *name, uint32_t value, const char *unit) {
+  char line[64];
+
+  snprintf(line, sizeof(line), "BENCH %s = %lu %s", name,
+           (unsigned long)value, unit);
+  TEST_MESSAGE(line);
+}
+
+// Play the pulse train, while taking out its events like the main loop does
+static void run_train() {
+  ChannelTiming timing[N_CHANNELS];
+
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    timing[i].period = (uint64_t)(i + 1) * 100 * TICKS_PER_USEC;
+    timing[i].offset = (uint64_t)i * 20 * TICKS_PER_USEC;
+    timing[i].width = 10 * TICKS_PER_USEC;
+  }
+  engine_arm(timing, (uint64_t)BENCH_T_MEAS * TICKS_PER_MSEC);
+  engine_fire();
+
+  uint32_t c_prev = DWT->CYCCNT;
+  while (engine_running()) {
+    PulseEvent ev;
+    while (engine_pop_event(ev)) {
+      n_events++;
+    }
+
+    uint32_t c = DWT->CYCCNT;
+    if (c - c_prev > loop_max) {
+      loop_max = c - c_prev;
+    }
+    c_prev = c;
+  }
+  engine_bench(stats);
+}
+
+/*------------------------------------------------------------------------------
+  Tests
+------------------------------------------------------------------------------*/
+
+void test_edge_lateness() {
+  char name[16];
+
+  for (uint8_t i = 0; i < BENCH_BINS; i++) {
+    snprintf(name, sizeof(name), "late_hist[%u]", i);
+    report(name, stats.late_hist[i], "edges");
+  }
+  report("late_bin", BENCH_BIN_TICKS, "ticks");
+  report("late_max", stats.late_max, "ticks");
+  report("events", n_events, "");
+
+  TEST_ASSERT_GREATER_THAN_UINT32(0, n_events);
+  TEST_ASSERT_EQUAL_UINT32(0, engine_dropped_events());
+  TEST_ASSERT_LESS_THAN_UINT32(LATE_MAX, stats.late_max);
+}
+
+void test_isr_latency() {
+  report("isr_max", stats.isr_max, "ticks");
+  report("isr_n", stats.isr_n, "");
+
+  TEST_ASSERT_LESS_THAN_UINT32(ISR_MAX, stats.isr_max);
+}
+
+void test_loop_latency() {
+  report("loop_max", loop_max / CYCLES_PER_USEC, "usec");
+
+  TEST_ASSERT_LESS_THAN_UINT32(LOOP_MAX_USEC * CYCLES_PER_USEC, loop_max);
+}
+
+void test_serial_command_cost() {
+  static const char data[] = "DT100000\nW5000\nC2:PH250\nC1:DIV2\nSQA1000,1\n"
+                             "SQA1000,0\nTRIG1\nPPM-12.5\n?\ns\n";
+  const uint32_t n_bytes = sizeof(data) - 1;
+  MemStream stream(data);
+  DvG_SerialCommand sc(stream);
+  uint32_t n_cmds = 0;
+
+  uint32_t c_start = DWT->CYCCNT;
+  while (stream.available()) {
+    if (sc.available()) {
+      sc.getCmd();
+      n_cmds++;
+    }
+  }
+  uint32_t cycles = DWT->CYCCNT - c_start;
+
+  report("available_per_byte", cycles / n_bytes, "cycles");
+
+  TEST_ASSERT_EQUAL_UINT32(10, n_cmds);
+  TEST_ASSERT_LESS_THAN_UINT32(AVAILABLE_MAX_CYCLES_PER_BYTE, cycles / n_bytes);
+}
+
+void test_neopixel_blackout() {
+  Adafruit_NeoPixel neo(1, PIN_NEOPIXEL, NEO_GRB + NEO_KHZ800);
+
+  neo.begin();
+  neo.setPixelColor(0, neo.Color(0, 0, 255));
+  while (!neo.canShow()) {}
+
+  uint32_t c_start = DWT->CYCCNT;
+  neo.show();
+  uint32_t cycles = DWT->CYCCNT - c_start;
+
+  report("neo_show", cycles / CYCLES_PER_USEC, "usec");
+
+  TEST_ASSERT_LESS_THAN_UINT32(NEO_MAX_USEC * CYCLES_PER_USEC, cycles);
+}
+
+/*------------------------------------------------------------------------------
+  setup & loop
+------------------------------------------------------------------------------*/
+
+void setup() {
+  delay(2000); // Give the host time to open the serial port
+
+  for (uint8_t i = 0; i < N_CHANNELS; i++) {
+    pinMode(channel_pins[i], OUTPUT);
+  }
+  pinMode(LED_BUILTIN, OUTPUT);
+  pinMode(PIN_SYNC_OUT, OUTPUT);
+  engine_begin();
+  engine_stop();
+  cycles_begin();
+
+  run_train();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_edge_lateness);
+  RUN_TEST(test_isr_latency);
+  RUN_TEST(test_loop_latency);
+  RUN_TEST(test_serial_command_cost);
+  RUN_TEST(test_neopixel_blackout);
+  UNITY_END();
+}
+
+void loop() {}